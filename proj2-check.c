@@ -0,0 +1,466 @@
+///
+/// @file proj2-check.c
+/// @brief Validates output or binary trace of proj2 in one pass
+/// @date 30.04.2023
+/// @author Konstantin Romanets (xroman18), xroman18(at)stud.fit.vutbr.cz
+///
+/// @copyright VUT FIT 2023
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "proj2.h"
+
+/// Amount of reported violations, the rest is only counted
+#define MAX_REPORTED 20
+
+/// Client's state, it only moves forward
+enum ClientState {
+    CS_NONE,
+    CS_STARTED,
+    CS_ENTERED,
+    CS_CALLED,
+    CS_HOME
+};
+
+/// Worker's state
+enum WorkerState {
+    WS_NONE,
+    WS_IDLE,
+    WS_SERVING,
+    WS_BREAK,
+    WS_HOME
+};
+
+/// State of validation
+typedef struct checker {
+    // Number of the last checked line
+    uint64_t line;
+    // Post office is closed
+    bool is_closed;
+    // Amount of found violations
+    uint64_t violations;
+    // State of every client, indexed by client's number
+    uint8_t *clients;
+    // Service that every client entered for, indexed by client's number
+    uint16_t *services;
+    // Size of clients and services
+    size_t clients_size;
+    // State of every worker, indexed by worker's number
+    uint8_t *workers;
+    // Size of workers
+    size_t workers_size;
+    // Clients called for every service
+    uint64_t called[MAX_SERVICES + 1];
+    // Services served by workers for every service
+    uint64_t served[MAX_SERVICES + 1];
+    // Seen events, bit (actor * 8 + action) is set for every seen kind of event
+    uint64_t seen;
+} Checker;
+
+/// @brief Prints error message and exits with EXIT_FAILURE
+/// @param msg Error message
+void error(const char* msg) {
+    fprintf(stderr, "[ERROR] %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+/// @brief Reports violation of an invariant on the current line
+/// @param checker State of validation
+/// @param msg Description of the violation
+void violation(Checker *checker, const char *msg) {
+    if (checker->violations++ < MAX_REPORTED)
+        printf("line %llu: %s\n", (unsigned long long)checker->line, msg);
+}
+
+/// @brief Grows state array, so that index fits in
+/// @param array Array to grow, new items are zeroed
+/// @param size Size of array in items, updated
+/// @param item Size of one item
+/// @param index Index that must fit
+void grow(void **array, size_t *size, size_t item, size_t index) {
+    if (index < *size)
+        return;
+
+    size_t new_size = *size ? *size : 1024;
+    while (new_size <= index)
+        new_size *= 2;
+    *array = realloc(*array, new_size * item);
+    if (*array == NULL)
+        error("Failed to allocate memory");
+    memset((char*)*array + *size * item, 0, (new_size - *size) * item);
+    *size = new_size;
+}
+
+/// @brief Checks client's event
+/// @param checker State of validation
+/// @param record Client's event
+void check_client(Checker *checker, const TraceRecord *record) {
+    // Both arrays have the same size, so they grow the same way
+    size_t size = checker->clients_size;
+    grow((void**)&checker->clients, &checker->clients_size, sizeof(uint8_t), record->id);
+    grow((void**)&checker->services, &size, sizeof(uint16_t), record->id);
+    uint8_t *state = &checker->clients[record->id];
+
+    switch (record->action) {
+        case CA_STARTED:
+            if (*state != CS_NONE)
+                violation(checker, "client started twice");
+            *state = CS_STARTED;
+            break;
+        case CA_ENTERING_OFFICE:
+            if (*state != CS_STARTED)
+                violation(checker, "client entered without starting or twice");
+            if (checker->is_closed)
+                violation(checker, "client entered closed office");
+            *state = CS_ENTERED;
+            checker->services[record->id] = record->service;
+            break;
+        case CA_CALLED_BY_WORKER:
+            if (*state != CS_ENTERED)
+                violation(checker, "client called without entering or twice");
+            *state = CS_CALLED;
+            checker->called[checker->services[record->id]]++;
+            break;
+        case CA_FINISHED:
+            if (*state != CS_STARTED && *state != CS_CALLED)
+                violation(checker, "client went home while waiting, before starting or twice");
+            *state = CS_HOME;
+            break;
+    }
+}
+
+/// @brief Checks worker's event
+/// @param checker State of validation
+/// @param record Worker's event
+void check_worker(Checker *checker, const TraceRecord *record) {
+    grow((void**)&checker->workers, &checker->workers_size, sizeof(uint8_t), record->id);
+    uint8_t *state = &checker->workers[record->id];
+
+    switch (record->action) {
+        case WA_STARTED:
+            if (*state != WS_NONE)
+                violation(checker, "worker started twice");
+            *state = WS_IDLE;
+            break;
+        case WA_SERVING_START:
+            if (*state != WS_IDLE)
+                violation(checker, "worker started serving while not idle");
+            *state = WS_SERVING;
+            checker->served[record->service]++;
+            break;
+        case WA_SERVING_END:
+            if (*state != WS_SERVING)
+                violation(checker, "worker finished service it didn't start");
+            *state = WS_IDLE;
+            break;
+        case WA_BREAK_START:
+            if (*state != WS_IDLE)
+                violation(checker, "worker took break while not idle");
+            if (checker->is_closed)
+                violation(checker, "worker took break after closing");
+            *state = WS_BREAK;
+            break;
+        case WA_BREAK_END:
+            if (*state != WS_BREAK)
+                violation(checker, "worker finished break it didn't take");
+            *state = WS_IDLE;
+            break;
+        case WA_FINISHED:
+            if (*state != WS_IDLE)
+                violation(checker, "worker went home while not idle");
+            if (!checker->is_closed)
+                violation(checker, "worker went home before closing");
+            *state = WS_HOME;
+            break;
+    }
+}
+
+/// @brief Checks one event
+/// @param checker State of validation
+/// @param record Event to check
+void check_record(Checker *checker, const TraceRecord *record) {
+    checker->line++;
+    if (record->seq != checker->line)
+        violation(checker, "wrong line number");
+    // Every actor has its own actions, post office only closes
+    bool is_valid;
+    switch (record->actor) {
+        case ACTOR_CLIENT:
+            is_valid = record->action <= CA_FINISHED;
+            break;
+        case ACTOR_WORKER:
+            is_valid = record->action <= WA_FINISHED;
+            break;
+        case ACTOR_OFFICE:
+            is_valid = record->action == 0;
+            break;
+        default:
+            is_valid = false;
+    }
+    if (!is_valid || record->service > MAX_SERVICES) {
+        violation(checker, "invalid record");
+        return;
+    }
+    checker->seen |= (uint64_t)1 << (record->actor * 8 + record->action);
+
+    if (record->actor == ACTOR_CLIENT) {
+        check_client(checker, record);
+    } else if (record->actor == ACTOR_WORKER) {
+        check_worker(checker, record);
+    } else {
+        if (checker->is_closed)
+            violation(checker, "office closed twice");
+        checker->is_closed = true;
+    }
+}
+
+/// @brief Parses decimal number
+/// @param text Text to parse, moved after the number
+/// @param end End of line
+/// @param value Parsed number
+/// @return Whether there was a number
+bool parse_number(const char **text, const char *end, uint64_t *value) {
+    const char *start = *text;
+    *value = 0;
+    while (*text < end && **text >= '0' && **text <= '9' && *text - start < 19)
+        *value = *value * 10 + (*(*text)++ - '0');
+    return *text > start;
+}
+
+/// @brief Skips expected text
+/// @param text Text to parse, moved after the expected text
+/// @param end End of line
+/// @param expected Expected text
+/// @return Whether the text was there
+bool parse_text(const char **text, const char *end, const char *expected) {
+    size_t length = strlen(expected);
+    if ((size_t)(end - *text) < length || memcmp(*text, expected, length) != 0)
+        return false;
+    *text += length;
+    return true;
+}
+
+/// Ends of client's and worker's lines after "Z id: " or "U id: ", ones with a service end with its number
+typedef struct line_suffix {
+    // Text after actor's number
+    const char *text;
+    // enum ClientAction or enum WorkerAction
+    uint8_t action;
+    // Service's number follows
+    bool has_service;
+} LineSuffix;
+
+/// Suffixes of client's lines
+static const LineSuffix client_suffixes[] = {
+    {"started", CA_STARTED, false},
+    {"entering office for a service ", CA_ENTERING_OFFICE, true},
+    {"called by office worker", CA_CALLED_BY_WORKER, false},
+    {"going home", CA_FINISHED, false},
+    {NULL, 0, false}
+};
+
+/// Suffixes of worker's lines
+static const LineSuffix worker_suffixes[] = {
+    {"started", WA_STARTED, false},
+    {"serving a service of type ", WA_SERVING_START, true},
+    {"service finished", WA_SERVING_END, false},
+    {"taking break", WA_BREAK_START, false},
+    {"break finished", WA_BREAK_END, false},
+    {"going home", WA_FINISHED, false},
+    {NULL, 0, false}
+};
+
+/// @brief Parses one line of text output
+/// @param text Start of line
+/// @param end End of line, without the new line
+/// @param record Parsed event
+/// @return Whether the line has valid format
+bool parse_line(const char *text, const char *end, TraceRecord *record) {
+    uint64_t value;
+    memset(record, 0, sizeof(*record));
+    if (!parse_number(&text, end, &record->seq) || !parse_text(&text, end, ": "))
+        return false;
+
+    if (parse_text(&text, end, "closing")) {
+        record->actor = ACTOR_OFFICE;
+        return text == end;
+    }
+
+    const LineSuffix *suffixes;
+    if (parse_text(&text, end, "Z ")) {
+        record->actor = ACTOR_CLIENT;
+        suffixes = client_suffixes;
+    } else if (parse_text(&text, end, "U ")) {
+        record->actor = ACTOR_WORKER;
+        suffixes = worker_suffixes;
+    } else {
+        return false;
+    }
+    if (!parse_number(&text, end, &value) || value > UINT32_MAX || !parse_text(&text, end, ": "))
+        return false;
+    record->id = value;
+
+    for (const LineSuffix *suffix = suffixes; suffix->text; suffix++) {
+        if (!parse_text(&text, end, suffix->text))
+            continue;
+        record->action = suffix->action;
+        if (suffix->has_service) {
+            if (!parse_number(&text, end, &value) || value == 0 || value > MAX_SERVICES)
+                return false;
+            record->service = value;
+        }
+        return text == end;
+    }
+    return false;
+}
+
+/// @brief Checks text output line by line
+/// @param checker State of validation
+/// @param data Content of the output
+/// @param size Size of the output
+void check_output(Checker *checker, const char *data, size_t size) {
+    const char *end = data + size;
+    for (const char *line = data; line < end;) {
+        const char *line_end = memchr(line, '\n', end - line);
+        if (line_end == NULL) {
+            checker->line++;
+            violation(checker, "line doesn't end with new line");
+            return;
+        }
+
+        TraceRecord record;
+        if (parse_line(line, line_end, &record)) {
+            check_record(checker, &record);
+        } else {
+            checker->line++;
+            violation(checker, "invalid format");
+        }
+        line = line_end + 1;
+    }
+}
+
+/// @brief Checks state at the end of output
+/// @param checker State of validation
+/// @param NZ Expected amount of clients, 0 if not checked
+/// @param NU Expected amount of workers, 0 if not checked
+void check_end(Checker *checker, uint64_t NZ, uint64_t NU) {
+    if (!checker->is_closed)
+        violation(checker, "office never closed");
+
+    uint64_t clients = 0, workers = 0;
+    for (size_t i = 0; i < checker->clients_size; i++) {
+        if (checker->clients[i] == CS_NONE)
+            continue;
+        clients++;
+        if (checker->clients[i] != CS_HOME)
+            violation(checker, "client never went home");
+    }
+    for (size_t i = 0; i < checker->workers_size; i++) {
+        if (checker->workers[i] == WS_NONE)
+            continue;
+        workers++;
+        if (checker->workers[i] != WS_HOME)
+            violation(checker, "worker never went home");
+    }
+
+    for (int i = 0; i <= MAX_SERVICES; i++)
+        if (checker->called[i] != checker->served[i])
+            violation(checker, "called clients don't match served services");
+
+    if (NZ && clients != NZ)
+        violation(checker, "wrong amount of clients");
+    if (NU && workers != NU)
+        violation(checker, "wrong amount of workers");
+
+    // Not violations, but probably not what was meant to be tested, warned about as tests/control.sh does,
+    // which misses only the warning about workers going home
+    static const struct {
+        uint8_t actor, action;
+        const char *name;
+    } kinds[] = {
+        {ACTOR_CLIENT, CA_STARTED, "Z started"},
+        {ACTOR_CLIENT, CA_ENTERING_OFFICE, "Z entering office"},
+        {ACTOR_CLIENT, CA_CALLED_BY_WORKER, "Z called by office worker"},
+        {ACTOR_CLIENT, CA_FINISHED, "Z going home"},
+        {ACTOR_WORKER, WA_STARTED, "U started"},
+        {ACTOR_WORKER, WA_BREAK_START, "U taking break"},
+        {ACTOR_WORKER, WA_BREAK_END, "U finishing break"},
+        {ACTOR_WORKER, WA_SERVING_START, "U serving a service"},
+        {ACTOR_WORKER, WA_SERVING_END, "U finished a service"},
+        {ACTOR_WORKER, WA_FINISHED, "U going home"},
+        {ACTOR_OFFICE, 0, "closing"}
+    };
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(*kinds); i++)
+        if (!(checker->seen & ((uint64_t)1 << (kinds[i].actor * 8 + kinds[i].action))))
+            fprintf(stderr, "WARNING: no %s\n", kinds[i].name);
+}
+
+/// @brief Main function
+/// @param argc Number of arguments
+/// @param argv Arguments' array, optional path to output (proj2.out by default) or to binary trace
+///             (if it ends with .trace), optionally followed by expected NZ and NU
+int main(int argc, char** argv) {
+    if (argc != 1 && argc != 2 && argc != 4)
+        error("Usage: proj2-check [FILE [NZ NU]]");
+
+    const char *path = argc > 1 ? argv[1] : "proj2.out";
+    uint64_t NZ = 0, NU = 0;
+    if (argc == 4) {
+        char *end_nz, *end_nu;
+        NZ = strtoull(argv[2], &end_nz, 10);
+        NU = strtoull(argv[3], &end_nu, 10);
+        if (*end_nz != '\0' || *end_nu != '\0' || NZ == 0 || NU == 0)
+            error("Usage: proj2-check [FILE [NZ NU]]");
+    }
+
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) == -1)
+        error("Failed to open file");
+
+    // Whole file is mapped and read once from start to end
+    const char *data = NULL;
+    size_t size = info.st_size;
+    if (size > 0) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+            error("Failed to map file");
+        madvise((void*)data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    Checker checker = {0};
+    size_t length = strlen(path);
+    if (length >= 6 && strcmp(path + length - 6, ".trace") == 0) {
+        if (size % sizeof(TraceEntry) != 0)
+            error("Trace file is truncated");
+        const TraceEntry *entries = (const TraceEntry*)data;
+        for (size_t i = 0; i < size / sizeof(TraceEntry); i++) {
+            TraceRecord record = trace_record(&entries[i], i);
+            check_record(&checker, &record);
+        }
+    } else {
+        check_output(&checker, data, size);
+    }
+    check_end(&checker, NZ, NU);
+
+    if (checker.violations > MAX_REPORTED)
+        printf("... %llu more\n", (unsigned long long)(checker.violations - MAX_REPORTED));
+    if (checker.violations == 0)
+        printf("OK %llu lines\n", (unsigned long long)checker.line);
+
+    if (data)
+        munmap((void*)data, size);
+    free(checker.clients);
+    free(checker.services);
+    free(checker.workers);
+    return checker.violations ? EXIT_FAILURE : EXIT_SUCCESS;
+}
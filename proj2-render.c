@@ -0,0 +1,63 @@
+///
+/// @file proj2-render.c
+/// @brief Renders binary trace of proj2 to its text output
+/// @date 30.04.2023
+/// @author Konstantin Romanets (xroman18), xroman18(at)stud.fit.vutbr.cz
+///
+/// @copyright VUT FIT 2023
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "proj2.h"
+
+/// Amount of entries read at once
+#define RECORDS_COUNT 4096
+
+/// Size of one formatted line, fits any line
+#define LINE_SIZE 64
+
+/// @brief Prints error message and exits with EXIT_FAILURE
+/// @param msg Error message
+void error(const char* msg) {
+    fprintf(stderr, "[ERROR] %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+/// @brief Main function
+/// @param argc Number of arguments
+/// @param argv Arguments' array, optional path to trace (proj2.trace by default)
+int main(int argc, char** argv) {
+    if (argc > 2)
+        error("Usage: proj2-render [TRACE]");
+
+    FILE *trace = fopen(argc == 2 ? argv[1] : "proj2.trace", "rb");
+    if (trace == NULL)
+        error("Failed to open trace file");
+
+    static TraceEntry entries[RECORDS_COUNT];
+    static char output[RECORDS_COUNT * LINE_SIZE];
+
+    size_t count;
+    uint64_t index = 0;
+    while ((count = fread(entries, sizeof(TraceEntry), RECORDS_COUNT, trace)) > 0) {
+        size_t used = 0;
+        for (size_t i = 0; i < count; i++) {
+            TraceRecord record = trace_record(&entries[i], index++);
+            int length = format_record(output + used, LINE_SIZE, &record);
+            if (length < 0 || length >= LINE_SIZE)
+                error("Invalid trace record");
+            used += length;
+        }
+
+        if (fwrite(output, 1, used, stdout) != used)
+            error("Failed to write output");
+    }
+
+    if (ferror(trace))
+        error("Failed to read trace file");
+
+    fclose(trace);
+    return 0;
+}
@@ -0,0 +1,147 @@
+///
+/// @file proj2-top.c
+/// @brief Shows live statistics of a running proj2
+/// @date 30.04.2023
+/// @author Konstantin Romanets (xroman18), xroman18(at)stud.fit.vutbr.cz
+///
+/// @copyright VUT FIT 2023
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "proj2.h"
+
+/// Interval between two samples in milliseconds
+#define INTERVAL_MS 1000
+
+/// @brief Prints error message and exits with EXIT_FAILURE
+/// @param msg Error message
+void error(const char* msg) {
+    fprintf(stderr, "[ERROR] %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+/// @brief Maps statistics of a simulation
+/// @param name Name of statistics' shared memory
+/// @return Statistics, NULL if they can't be opened
+const Stats* open_stats(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+        return NULL;
+
+    const Stats *stats = mmap(NULL, sizeof(Stats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return stats == MAP_FAILED ? NULL : stats;
+}
+
+/// @brief Checks whether the simulation is still running
+/// @param stats Statistics of the simulation
+/// @return false if its process is gone, e.g. it died without removing its statistics
+bool is_running(const Stats *stats) {
+    return !atomic_load(&stats->finished) && (kill(stats->pid, 0) == 0 || errno != ESRCH);
+}
+
+/// @brief Finds statistics of some running simulation
+/// @return Statistics, NULL if none was found
+/// @note Statistics left behind by simulations that died are skipped
+const Stats* find_stats(void) {
+    DIR *dir = opendir("/dev/shm");
+    if (dir == NULL)
+        return NULL;
+
+    const Stats *found = NULL;
+    struct dirent *entry;
+    while (found == NULL && (entry = readdir(dir)) != NULL) {
+        // Names in /dev/shm are without the leading slash
+        if (strncmp(entry->d_name, STATS_NAME + 1, strlen(STATS_NAME) - 1) != 0)
+            continue;
+
+        char name[300];
+        snprintf(name, sizeof(name), "/%s", entry->d_name);
+        found = open_stats(name);
+        if (found && !is_running(found)) {
+            munmap((void *)found, sizeof(Stats));
+            found = NULL;
+        }
+    }
+
+    closedir(dir);
+    return found;
+}
+
+/// @brief Prints one sample of statistics
+/// @param stats Statistics to print
+/// @param events_per_second Events logged since previous sample per second
+void print_stats(const Stats *stats, double events_per_second) {
+    double elapsed = (monotonic_ns() - stats->started) / 1e9;
+    printf("%8.1fs  events/s %10.0f  served %8llu  turned away %6llu  serving %4d  break %4d  idle %4d%s\n",
+           elapsed, events_per_second,
+           (unsigned long long)atomic_load_explicit(&stats->served, memory_order_relaxed),
+           (unsigned long long)atomic_load_explicit(&stats->turned_away, memory_order_relaxed),
+           atomic_load_explicit(&stats->serving, memory_order_relaxed),
+           atomic_load_explicit(&stats->on_break, memory_order_relaxed),
+           atomic_load_explicit(&stats->idle, memory_order_relaxed),
+           atomic_load_explicit(&stats->closed, memory_order_relaxed) ? "  closed" : "");
+
+    printf("          queues");
+    int services = stats->services < MAX_SERVICES ? stats->services : MAX_SERVICES;
+    for (int i = 0; i < services; i++)
+        printf(" %d", atomic_load_explicit(&stats->queues[i].count, memory_order_relaxed));
+    printf("\n");
+    fflush(stdout);
+}
+
+/// @brief Main function
+/// @param argc Number of arguments
+/// @param argv Arguments' array, optional pid of simulation started with --stats (any of them by default)
+int main(int argc, char** argv) {
+    if (argc > 2)
+        error("Usage: proj2-top [PID]");
+
+    const Stats *stats;
+    if (argc == 2) {
+        char *end;
+        long pid = strtol(argv[1], &end, 10);
+        if (*argv[1] == '\0' || *end != '\0' || pid <= 0)
+            error("Usage: proj2-top [PID]");
+
+        char name[32];
+        snprintf(name, sizeof(name), STATS_NAME "%ld", pid);
+        stats = open_stats(name);
+        if (stats == NULL)
+            error("Failed to open statistics");
+    } else {
+        stats = find_stats();
+        if (stats == NULL)
+            error("No simulation with --stats is running");
+    }
+
+    uint64_t events = atomic_load_explicit(&stats->events, memory_order_relaxed);
+    uint64_t time = monotonic_ns();
+
+    // Mapping stays valid after the simulation unlinks it, finished is its last write,
+    // simulation that died never sets it
+    while (is_running(stats)) {
+        struct timespec interval = {.tv_sec = INTERVAL_MS / 1000, .tv_nsec = INTERVAL_MS % 1000 * 1000000L};
+        nanosleep(&interval, NULL);
+
+        uint64_t now_events = atomic_load_explicit(&stats->events, memory_order_relaxed);
+        uint64_t now = monotonic_ns();
+        print_stats(stats, (now_events - events) * 1e9 / (now - time));
+        events = now_events;
+        time = now;
+    }
+
+    munmap((void *)stats, sizeof(Stats));
+    return 0;
+}
@@ -7,6 +7,8 @@
 /// @copyright VUT FIT 2023
 ///
 
+// sched_setaffinity() and CPU sets
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -16,90 +18,803 @@
 #include <time.h>
 #include <wait.h>
 #include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/prctl.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <signal.h>
 
-/// Sets seed for rand() \n
-/// time(NULL) xor getpid() is random enough
-#define SET_RANDOM srand(time(NULL) ^ getpid()); // NOLINT(cert-msc51-cpp)
+#include "proj2.h"
 
-/// Shortcut to call rand() with min and max values
-#define RAND(min, max) (rand() % (max - min + 1) + min) // NOLINT(cert-msc50-cpp
+/// Calls Sem_init and checks for error during semaphore creation
+#define INIT_SEM(sem, pshared, value) if (Sem_init(&sem, pshared, value) == -1) error("Failed to initialize semaphore")
 
-/// Calls sem_init and checks for error during semaphore creation
-#define INIT_SEM(sem, pshared, value) if (sem_init(&sem, pshared, value) == -1) error("Failed to initialize semaphore")
+/// Calls Sem_destroy and checks for error during semaphore destruction
+#define DEST_SEM(sem) if (Sem_destroy(&sem) == -1) error("Failed to destroy semaphore")
 
-/// Calls sem_destroy and checks for error during semaphore destruction
-#define DEST_SEM(sem) if (sem_destroy(&sem) == -1) error("Failed to destroy semaphore")
+/// Max amount of tries before futex semaphore parks the caller
+#define SEM_SPIN_MAX 1024
+
+/// Size of one log ring slot, fits any line or trace record
+#define LOG_SLOT_SIZE 64
+
+/// Amount of slots in log ring
+#define LOG_RING_SIZE 4096
+
+/// Size of log writer's buffer
+#define LOG_BUFFER_SIZE (1 << 16)
+
+/// Low bits of log position hold line number, high bits hold byte offset in output file
+#define LOG_SEQ_BITS 29
+
+/// Mask of line number in log position
+#define LOG_SEQ_MASK (((uint64_t)1 << LOG_SEQ_BITS) - 1)
+
+/// Size of memory-mapped output file until it's truncated to its real length
+#define LOG_MAP_SIZE ((uint64_t)1 << (64 - LOG_SEQ_BITS))
+
+/// Clients forked by one spawner process in process mode, their starts are logged at once
+#define CLIENT_BATCH 64
+
+/// Ticket slot's called value while client's executor waits for the call, see executor_park()
+#define TICKET_PARKED 2
+
+/// Histogram keeps 2^HISTOGRAM_SUB_BITS buckets for every power of two
+#define HISTOGRAM_SUB_BITS 4
+
+/// Amount of buckets of histogram, enough for any 64-bit value
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+/// Amount of slots of executor's timer wheel, it spans WHEEL_SLOTS * WHEEL_TICK_NS (about 268 ms)
+#define WHEEL_SLOTS 4096
+
+/// Width of one slot of executor's timer wheel in nanoseconds
+#define WHEEL_TICK_NS ((uint64_t)1 << 16)
+
+/// Max amount of NUMA nodes that pinned actors are placed on
+#define MAX_NODES 64
+
+/// Size of huge page that --huge-pages mappings are rounded up to
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+/// Waits on semaphore of SharedMemory by its field name.
+/// Compile with -DSEM_STATS to count its acquisitions and waiting, see print_sem_stats().
+#ifdef SEM_STATS
+#define WAIT_SEM(memory, sem) Sem_wait_counted(&(memory)->sem, &(memory)->sem_stats.sem)
+#else
+#define WAIT_SEM(memory, sem) Sem_wait(&(memory)->sem)
+#endif
+
+/// Lines kept in debug ring of every actor, older lines are overwritten
+#define DEBUG_RING_LINES 32
+
+/// Size of one debug line, longer messages are truncated
+#define DEBUG_LINE_SIZE 120
 
 /// Debug messages.
-/// Compile with -DDEBUG to see them.
+/// Compile with -DDEBUG to see them. They go to per-actor rings in shared memory instead of stderr,
+/// so that tracing doesn't serialize the processes, and are printed at exit, see debug_dump().
+/// DEBUG_ACTOR selects ring of actor whose code runs in the calling process or thread.
 #ifdef DEBUG
-#define PRINT(...) fprintf(stderr, __VA_ARGS__)
+#define PRINT(...) debug_print(__VA_ARGS__)
+#define DEBUG_ACTOR(actor, id) debug_actor(actor, id)
 #else
 #define PRINT(...)
+#define DEBUG_ACTOR(actor, id)
+#endif
+
+/// Represents what actor waits for between two of its steps.
+enum WaitType {
+    // Sleep for `arg` microseconds
+    WT_SLEEP,
+    // Wait for worker to call client from queue `arg` (1..services)
+    WT_QUEUE,
+    // Wait for post office to log closing
+    WT_POST_CLOSED,
+    // Wait for a client to enter the office or for the office to close
+    WT_WORK,
+    // Take a break for `arg` microseconds, but end it as soon as post office closes
+    WT_BREAK,
+    // Actor has finished
+    WT_DONE
+};
+
+/// Represents what is measured by a histogram.
+enum HistogramType {
+    // Client's wait between entering office and being called, in nanoseconds
+    HT_WAIT,
+    // Worker's time between serving start and end, in nanoseconds
+    HT_SERVICE,
+    // Worker's break time, in nanoseconds
+    HT_BREAK,
+    // Part of worker's time spent serving, in hundredths of percent
+    HT_UTILIZATION,
+    // Amount of histograms
+    HT_COUNT
+};
+
+/// Log-linear histogram, buckets are increased without any locks \n
+/// Relative error of any value is less than 2^-HISTOGRAM_SUB_BITS
+typedef struct histogram {
+    atomic_uint_fast64_t counts[HISTOGRAM_BUCKETS];
+    atomic_uint_fast64_t total;
+} Histogram;
+
+/// Actor's wait, returned from every step
+typedef struct wait {
+    enum WaitType type;
+    // Sleep time or queue number, depends on type
+    int arg;
+} Wait;
+
+/// Client's state between steps
+typedef struct client {
+    // Client's number (1..NZ)
+    u_int id;
+    // Selected service (1..services), 0 if not selected yet
+    int service;
+    // Last logged action
+    enum ClientAction action;
+    // Client's random generator state
+    uint64_t random;
+    // Time of entering office, see clock_ns()
+    uint64_t entered_at;
+    // Ticket in selected service's queue, see take_ticket()
+    u_int ticket;
+} Client;
+
+/// Worker's state between steps
+typedef struct worker {
+    // Worker's number (1..NU)
+    u_int id;
+    // Service being served (1..services), 0 if none
+    int service;
+    // Last logged action
+    enum WorkerAction action;
+    // Worker's random generator state
+    uint64_t random;
+    // Time of start, see clock_ns()
+    uint64_t started_at;
+    // Time of the last serving or break start
+    uint64_t action_at;
+    // Total time spent serving in nanoseconds
+    uint64_t busy_ns;
+    // Service served from the local fast path in SP_AFFINITY schedule (1..services)
+    int preferred;
+} Worker;
+
+/// Post office's state between steps
+typedef struct office {
+    // Post office is already closed
+    bool is_closed;
+    // Post office's random generator state
+    uint64_t random;
+} Office;
+
+/// Represents how lines get to the output file.
+enum LogMode {
+    // Every line is written and flushed under the output semaphore
+    LOG_STDIO,
+    // Lines are put into shared ring, log writer writes them in batches
+    LOG_RING,
+    // Like LOG_RING, but binary trace records are written to proj2.trace instead of lines
+    LOG_BINARY,
+    // Lines are copied straight into memory-mapped output file
+    LOG_MMAP
+};
+
+/// Represents how workers choose queue to serve.
+enum SchedulePolicy {
+    // Random queue first, then first non-empty queue
+    SP_RANDOM,
+    // Worker's preferred queue first, then steal from the next non-empty queue after it
+    SP_AFFINITY
+};
+
+/// Represents when clients arrive at the office.
+enum ArrivalModel {
+    // Every client sleeps for random time up to TZ after it starts
+    AM_UNIFORM,
+    // Clients are started one by one with exponential gaps, at a given mean rate
+    AM_POISSON,
+    // Clients are started at times read from a file
+    AM_TRACE
+};
+
+/// Represents distribution of service time.
+enum ServiceDistribution {
+    // Whole milliseconds from 0 to max, uniformly
+    SD_UNIFORM,
+    // Always the mean
+    SD_FIXED,
+    // Exponential distribution with the mean
+    SD_EXPONENTIAL,
+    // Log-normal distribution with the mean
+    SD_LOGNORMAL
+};
+
+/// Distribution of one service's time
+typedef struct service_time {
+    enum ServiceDistribution type;
+    // Max for SD_UNIFORM, mean otherwise, in milliseconds
+    double time;
+    // Standard deviation of time's logarithm for SD_LOGNORMAL
+    double sigma;
+} ServiceTime;
+
+/// Slot of log ring, holds one line or trace record
+typedef struct log_slot {
+    // Line number the slot is ready for, see log_ring_record()
+    atomic_size_t seq;
+    union {
+        char line[LOG_SLOT_SIZE - sizeof(atomic_size_t)];
+        TraceEntry entry;
+    };
+} LogSlot;
+
+/// Program's arguments
+typedef struct args {
+    // Amount of clients
+    int NZ;
+    // Amount of workers
+    int NU;
+    // Max sleep time of client before entering the office
+    int TZ;
+    // Max break time of worker
+    int TU;
+    // Max time of post office being open
+    int F;
+    // Amount of pool threads, 0 to fork a process per client and worker
+    int threads;
+    // How lines get to the output file
+    enum LogMode log_mode;
+    // Seed all random generators are derived from
+    uint64_t seed;
+    // Seed was given by user
+    bool has_seed;
+    // Run as a discrete-event simulation in virtual time, without real sleeps
+    bool virtual_time;
+    // Output file, proj2.out or proj2.trace by default
+    const char *output;
+    // File with a configuration per line to run instead of a single one, NULL if none
+    const char *batch;
+    // Amount of configurations from batch file running at once
+    int jobs;
+    // Measure latencies and print their histograms at shutdown
+    bool latency;
+    // Amount of service types (1..MAX_SERVICES)
+    int services;
+    // Publish live statistics as named shared memory for proj2-top
+    bool stats;
+    // Validate every event while it's logged, see check_event()
+    bool check;
+    // Processes that run clients as state machines in process mode, 0 to fork a process per client
+    int executors;
+    // Back shared memory with huge pages, explicit ones if reserved, transparent ones otherwise
+    bool huge_pages;
+    // Fault all pages of shared memory in before actors start
+    bool prefault;
+    // Pin actors in process mode to CPUs of the NUMA node serving their queue, see Topology
+    bool pin;
+    // How workers choose queue to serve
+    enum SchedulePolicy schedule;
+    // When clients arrive at the office
+    enum ArrivalModel arrivals;
+    // Mean arrivals per second in AM_POISSON model
+    double arrival_rate;
+    // File with arrival time of a client in milliseconds per line in AM_TRACE model
+    const char *arrival_trace;
+    // Distribution of every service's time
+    ServiceTime service_times[MAX_SERVICES];
+} Arguments;
+
+/// Outcome of one simulation
+typedef struct result {
+    // Clients called by a worker
+    size_t served;
+    // Clients that came to a closed office
+    size_t turned_away;
+    // Logged events
+    size_t events;
+    // Real time from start to finish of the simulation in milliseconds
+    double wall_ms;
+    // Real time from the first logged event to the last client's event in milliseconds, events / active_ms is throughput
+    double active_ms;
+    // Real time from closing of the office to finish of the simulation in milliseconds
+    double close_ms;
+    // Peak resident set size of the largest process in kilobytes
+    long max_rss_kb;
+    // Sum of peak resident set sizes of all processes in kilobytes, shared pages count in every process touching them
+    long total_rss_kb;
+} Result;
+
+#ifdef SYNC_FUTEX
+/// Counting semaphore on a futex word \n
+/// Waiting spins for a while before it parks, the spin adapts to how often spinning succeeds
+typedef struct sem {
+    // Semaphore's value, also the futex word
+    atomic_uint value;
+    // Processes that are parked or about to park
+    atomic_uint waiters;
+    // Current spin limit, doubled when spinning succeeds and halved when it doesn't
+    atomic_int spin;
+} Sem;
+#else
+/// Counting semaphore, POSIX unnamed semaphore
+typedef sem_t Sem;
+#endif
+
+#ifdef SEM_STATS
+/// Contention of one semaphore, see WAIT_SEM
+typedef struct sem_stats {
+    // Successful waits
+    _Atomic uint64_t acquisitions;
+    // Waits that found the semaphore at zero
+    _Atomic uint64_t contended;
+    // Time spent in contended waits in nanoseconds
+    _Atomic uint64_t wait_ns;
+    // Longest contended wait in nanoseconds
+    _Atomic uint64_t max_wait_ns;
+} SemStats;
 #endif
 
-/// Represents worker's actions.
-enum WorkerAction {
-    // Started
-    WA_STARTED,
-    // Serving a service
-    WA_SERVING_START,
-    // Service finished
-    WA_SERVING_END,
-    // Taking a break
-    WA_BREAK_START,
-    // Break finished
-    WA_BREAK_END,
-    // Going home
-    WA_FINISHED
+/// Handoff between client with a ticket and worker that calls it
+typedef struct ticket_slot {
+    // Ticket was called, also the futex word client waits on in process mode, or TICKET_PARKED
+    atomic_uint called;
+    // Time of service drawn by worker, in microseconds
+    u_int service_time;
+    // Client's task is parked until the ticket is called, in thread mode
+    bool is_parked;
+    // Client's task in thread mode, client's index (0..NZ-1) with executors
+    int task;
+} TicketSlot;
+
+/// CPUs of NUMA nodes that actors are pinned to \n
+/// Queue i is served on node (i - 1) % nodes: its workers are pinned to the node's cores, its clients to the node
+/// while they wait in it and its ticket slots are allocated on the node
+typedef struct topology {
+    // Amount of nodes with a CPU the program may run on
+    int nodes;
+    // Node's number in /sys/devices/system/node for every node
+    int node_ids[MAX_NODES];
+    // CPUs of every node the program may run on
+    cpu_set_t cpus[MAX_NODES];
+    // Amount of CPUs of every node
+    int cpus_count[MAX_NODES];
+    // Workers already pinned to every node, the next one takes the node's next CPU
+    atomic_int workers[MAX_NODES];
+} Topology;
+
+/// Clients of one executor whose tickets were called \n
+/// Lock-free stack linked through SharedMemory's inbox_next, pushed by workers and emptied at once by executor
+typedef struct executor_inbox {
+    // Index of the last pushed client, -1 if empty
+    _Alignas(CACHE_LINE_SIZE) atomic_int head;
+    // Incremented by every push, also the futex word executor waits on
+    atomic_uint bell;
+    // Executor is about to wait on bell, pushes wake it up
+    atomic_bool is_waiting;
+} ExecutorInbox;
+
+/// Queue of clients waiting for one service \n
+/// Every queue has its own cache line, so clients of different services don't contend \n
+/// Clients are called strictly in FIFO order of their tickets
+typedef struct service_queue {
+    // Clients in queue, workers claim clients with compare-and-swap
+    _Alignas(CACHE_LINE_SIZE) atomic_int count;
+    // Next ticket to take
+    atomic_uint tail;
+    // Next ticket to call
+    atomic_uint head;
+    // Slot of every ticket, queue never gives more than NZ tickets
+    TicketSlot *slots;
+} ServiceQueue;
+
+/// Client's state in online checker, it only moves forward
+enum CheckedClient {
+    CC_NONE,
+    CC_STARTED,
+    CC_ENTERED,
+    CC_CALLED,
+    CC_HOME
 };
 
-/// Represents client's actions.
-enum ClientAction {
-    // Started
-    CA_STARTED,
-    // Entering office for service
-    CA_ENTERING_OFFICE,
-    // Called by office worker
-    CA_CALLED_BY_WORKER,
-    // Going home
-    CA_FINISHED
+/// Worker's state in online checker
+enum CheckedWorker {
+    CW_NONE,
+    CW_IDLE,
+    CW_SERVING,
+    CW_BREAK,
+    CW_HOME
 };
 
+/// Online checker of logged events \n
+/// Every actor changes only its own state, so states need no synchronization
+typedef struct checker {
+    // Size of the mapping
+    size_t size;
+    // Process that runs the simulation, it's killed on violation together with its children
+    pid_t main;
+    // Closing is logged, set only after its line got its number
+    atomic_bool is_closed;
+    // Clients called for every service
+    _Atomic uint64_t called[MAX_SERVICES + 1];
+    // Services started by workers for every service
+    _Atomic uint64_t served[MAX_SERVICES + 1];
+    // State of every client (0..NZ, enum CheckedClient), then of every worker (0..NU, enum CheckedWorker)
+    uint8_t states[];
+} Checker;
+
 /// Program's shared memory \n
-/// Contains all semaphores and other shared variables
+/// Contains all semaphores and other shared variables \n
+/// Fields are grouped by who writes them, and every group starts on its own cache line,
+/// so logging, office state and statistics don't invalidate each other's lines
 typedef struct mem {
+    // Read-mostly: set up before actors start
+
+    // Size of the mapping, including queues
+    size_t size;
+    // Program's arguments
+    Arguments args;
+    // Thread pool running actors, NULL in process mode
+    struct pool *pool;
+    // Current time in nanoseconds in virtual time mode, single-threaded
+    uint64_t virtual_time;
+    // Log ring, NULL if log mode is LOG_STDIO
+    LogSlot *log_ring;
+    // Thread writing lines from log ring to output file
+    pthread_t log_writer;
+    // Memory-mapped output file, NULL unless log mode is LOG_MMAP
+    char *log_map;
+    // Output file, proj2.trace in LOG_BINARY mode
+    FILE* file;
+    // Arrival time of every client since start in nanoseconds, NULL in AM_UNIFORM model
+    uint64_t *arrivals;
+    // Live statistics, named shared memory if they are published
+    Stats *stats;
+    // Online checker of logged events, NULL if events are not checked
+    Checker *checker;
+    // Inbox of every executor, NULL without executors
+    ExecutorInbox *inboxes;
+    // Next client in inbox for every client (0..NZ-1)
+    int *inbox_next;
+    // NUMA nodes actors are pinned to, NULL if they aren't
+    Topology *topology;
+
+    // Log state: written by every logged event
+
     // Output file lines count
-    size_t lines_count;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t lines_count;
+    // Last line number and end of its line in log map, see LOG_SEQ_BITS
+    _Atomic uint64_t log_position;
+    // All lines are logged, log writer can finish
+    atomic_bool log_done;
+    // Output file mutex
+    Sem output;
+
+    // Office state: written by clients entering and workers looking for work
 
     // Is post office open
-    bool post_open;
-    // Queues of clients
-    int queue[3];
+    _Alignas(CACHE_LINE_SIZE) atomic_bool post_open;
+    // Bit i - 1 is set if queue i may have clients, see claim_client()
+    _Atomic uint64_t queues_mask;
+    // Clients entering and workers taking break that saw post office open, see office_step()
+    atomic_int open_sections;
+    // Workers waiting for work, changed only under mutex
+    atomic_int idle_workers;
+    // Guards idle workers registration and closing
+    Sem mutex;
+    // Work is available or post is closed
+    Sem work;
+
+    // Shutdown: used once by the office and every worker
+
+    // Closing is logged, also the futex word workers wait on in process mode
+    _Alignas(CACHE_LINE_SIZE) atomic_uint is_closed;
+
+    // Statistics
+
+    // Latency histograms, used only if latency is measured
+    _Alignas(CACHE_LINE_SIZE) Histogram histograms[HT_COUNT];
+#ifdef SEM_STATS
+    // Contention of every semaphore, named after it
+    _Alignas(CACHE_LINE_SIZE) struct {
+        SemStats output, mutex, work;
+    } sem_stats;
+#endif
 
-    // Output file mutex
-    sem_t output;
-    // Global mutex guard
-    sem_t mutex;
-    // Queues semaphores that indicate availability
-    sem_t queue_sem[3];
-    // Post is closed notification
-    sem_t post_closed;
-    // Worker is leaving
-    sem_t leaving;
-
-    // Output file
-    FILE* file;
+    // Queues of clients, one per service, each in its own cache line
+    ServiceQueue queues[];
 } SharedMemory;
 
+#ifdef DEBUG
+/// One debug message
+typedef struct debug_line {
+    // Monotonic time of the message in nanoseconds
+    uint64_t time;
+    // Formatted message
+    char text[DEBUG_LINE_SIZE];
+} DebugLine;
+
+/// Last messages of one actor, written only by the actor itself
+typedef struct debug_ring {
+    // Messages written so far, the last DEBUG_RING_LINES of them are kept
+    uint64_t count;
+    DebugLine lines[DEBUG_RING_LINES];
+} DebugRing;
+
+/// Debug rings of all actors, shared by all processes
+typedef struct debug_log {
+    // Size of the mapping
+    size_t size;
+    // Monotonic time of the start in nanoseconds, dumped times are relative to it
+    uint64_t started;
+    // Rings are dumped already, only the first dump prints them
+    atomic_bool is_dumped;
+    // Amount of rings: main thread, post office, workers, clients
+    size_t count;
+    // Amount of workers
+    size_t workers;
+    DebugRing rings[];
+} DebugLog;
+
+/// Debug rings of running simulation, NULL outside of it
+DebugLog *debug_log = NULL;
+
+/// Ring of the actor that runs in this process or thread, main thread has its own one \n
+/// Threads and forked processes that don't run any actor have none, so they don't write somebody else's ring
+_Thread_local DebugRing *debug_ring = NULL;
+
+/// @brief Selects debug ring of the actor that runs in this process or thread
+/// @param actor Actor
+/// @param id Client's or worker's number, 0 for post office
+void debug_actor(enum Actor actor, u_int id) {
+    if (debug_log == NULL)
+        return;
+    // Rings are ordered as main thread, post office, workers, clients
+    size_t index = actor == ACTOR_OFFICE ? 1 : 1 + id;
+    if (actor == ACTOR_CLIENT)
+        index += debug_log->workers;
+    debug_ring = &debug_log->rings[index];
+}
+
+/// @brief Adds formatted message to debug ring of the running actor
+/// @param format Format of the message, as printf() takes
+void debug_print(const char *format, ...) {
+    DebugRing *ring = debug_ring;
+    if (debug_log == NULL || ring == NULL)
+        return;
+
+    DebugLine *line = &ring->lines[ring->count % DEBUG_RING_LINES];
+    line->time = monotonic_ns();
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line->text, DEBUG_LINE_SIZE, format, args);
+    va_end(args);
+    ring->count++;
+}
+
+/// @brief Compares debug lines by their time for qsort()
+int compare_debug_lines(const void *a, const void *b) {
+    uint64_t x = (*(DebugLine *const *)a)->time, y = (*(DebugLine *const *)b)->time;
+    return (x > y) - (x < y);
+}
+
+/// @brief Prints kept messages of all actors to stderr ordered by time, only once per simulation
+/// @note Lines that are being written while dumping may be torn
+void debug_dump(void) {
+    if (debug_log == NULL || atomic_exchange(&debug_log->is_dumped, true))
+        return;
+
+    size_t total = 0;
+    for (size_t i = 0; i < debug_log->count; i++) {
+        uint64_t count = debug_log->rings[i].count;
+        total += count < DEBUG_RING_LINES ? count : DEBUG_RING_LINES;
+    }
+
+    DebugLine **lines = malloc((total + 1) * sizeof(DebugLine*));
+    if (lines == NULL)
+        return;
+    size_t used = 0;
+    for (size_t i = 0; i < debug_log->count; i++) {
+        DebugRing *ring = &debug_log->rings[i];
+        uint64_t count = ring->count < DEBUG_RING_LINES ? ring->count : DEBUG_RING_LINES;
+        for (uint64_t j = 0; j < count && used < total; j++)
+            lines[used++] = &ring->lines[(ring->count - count + j) % DEBUG_RING_LINES];
+    }
+    qsort(lines, used, sizeof(DebugLine*), compare_debug_lines);
+
+    for (size_t i = 0; i < used; i++)
+        fprintf(stderr, "%12.6f ms %.*s", (lines[i]->time - debug_log->started) / 1e6, DEBUG_LINE_SIZE, lines[i]->text);
+    free(lines);
+}
+
+/// @brief Formats debug line as debug_dump() prints it without stdio, so that signal handler can use it
+/// @param buffer Output of at least 32 + DEBUG_LINE_SIZE bytes
+/// @param line Line to format
+/// @return Length of the formatted line
+size_t debug_format_line(char *buffer, const DebugLine *line) {
+    uint64_t time = line->time - debug_log->started;
+    // Milliseconds with nanoseconds behind the point, right aligned as "%12.6f ms "
+    char digits[32];
+    size_t count = 0;
+    do {
+        digits[count++] = (char)('0' + time % 10);
+        time /= 10;
+        if (count == 6)
+            digits[count++] = '.';
+    } while (time != 0 || count <= 7);
+
+    size_t length = 0;
+    for (size_t i = count; i < 12; i++)
+        buffer[length++] = ' ';
+    while (count != 0)
+        buffer[length++] = digits[--count];
+    buffer[length++] = ' ';
+    buffer[length++] = 'm';
+    buffer[length++] = 's';
+    buffer[length++] = ' ';
+    // Text is copied by hand, the line may be torn and miss its terminating zero
+    for (size_t i = 0; i < DEBUG_LINE_SIZE && line->text[i] != '\0'; i++)
+        buffer[length++] = line->text[i];
+    return length;
+}
+
+/// @brief Dumps debug rings when process crashes and crashes it for real
+/// @param signal Caught signal
+/// @note Uses only async-signal-safe calls, so unlike debug_dump() rings are printed one after another
+///       instead of ordered by time
+void debug_signal(int signal) {
+    static char buffer[32 + DEBUG_LINE_SIZE];
+    if (debug_log != NULL && !atomic_exchange(&debug_log->is_dumped, true)) {
+        for (size_t i = 0; i < debug_log->count; i++) {
+            DebugRing *ring = &debug_log->rings[i];
+            uint64_t count = ring->count < DEBUG_RING_LINES ? ring->count : DEBUG_RING_LINES;
+            for (uint64_t j = 0; j < count; j++) {
+                size_t length = debug_format_line(buffer, &ring->lines[(ring->count - count + j) % DEBUG_RING_LINES]);
+                if (write(STDERR_FILENO, buffer, length) == -1)
+                    break;
+            }
+        }
+    }
+    sigaction(signal, &(struct sigaction){.sa_handler = SIG_DFL}, NULL);
+    raise(signal);
+}
+#endif
+
 /// @brief Prints error message and exits with EXIT_FAILURE
 /// @param msg Error message
 void error(const char* msg) {
     fprintf(stderr, "[ERROR] %s\n", msg);
+#ifdef DEBUG
+    debug_dump();
+#endif
     exit(EXIT_FAILURE);
 }
 
+/// @brief Blocks until futex word changes from expected value, timeout passes, or spuriously
+/// @param word Futex word in shared memory
+/// @param expected Value the word had when caller decided to block
+/// @param timeout Max time to block, NULL to block until woken up
+void futex_wait(atomic_uint *word, u_int expected, const struct timespec *timeout) {
+    if (syscall(SYS_futex, word, FUTEX_WAIT, expected, timeout, NULL, 0) == -1
+        && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT)
+        error("Failed to wait on futex");
+}
+
+/// @brief Wakes processes blocked on futex word
+/// @param word Futex word in shared memory
+/// @param count Max amount of processes to wake
+void futex_wake(atomic_uint *word, int count) {
+    if (syscall(SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0) == -1)
+        error("Failed to wake futex");
+}
+
+#ifdef SYNC_FUTEX
+/// @brief Decrements semaphore if its value is above zero
+/// @return true if semaphore was decremented
+bool Sem_try(Sem *sem) {
+    u_int value = atomic_load_explicit(&sem->value, memory_order_relaxed);
+    while (value > 0)
+        if (atomic_compare_exchange_weak(&sem->value, &value, value - 1))
+            return true;
+    return false;
+}
+
+/// @brief Initializes semaphore, it's always shared between processes
+/// @return 0 on success, as sem_init() does
+int Sem_init(Sem *sem, int pshared, u_int value) {
+    (void)pshared;
+    atomic_init(&sem->value, value);
+    atomic_init(&sem->waiters, 0);
+    atomic_init(&sem->spin, SEM_SPIN_MAX / 16);
+    return 0;
+}
+
+/// @brief Destroys semaphore, fails if somebody is parked on it
+/// @return 0 on success, -1 on failure, as sem_destroy() does
+int Sem_destroy(Sem *sem) {
+    return atomic_load(&sem->waiters) == 0 ? 0 : -1;
+}
+
+/// @brief Decrements semaphore, spins and then parks while its value is zero
+void Sem_wait(Sem *sem) {
+    int spin = atomic_load_explicit(&sem->spin, memory_order_relaxed);
+    for (int i = 0; i < spin; i++) {
+        if (Sem_try(sem)) {
+            if (spin < SEM_SPIN_MAX)
+                atomic_store_explicit(&sem->spin, spin * 2, memory_order_relaxed);
+            return;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    if (spin > 1)
+        atomic_store_explicit(&sem->spin, spin / 2, memory_order_relaxed);
+
+    // Announce waiter before the last try, so that Sem_post() either sees it or leaves value for the try
+    atomic_fetch_add(&sem->waiters, 1);
+    while (!Sem_try(sem))
+        futex_wait(&sem->value, 0, NULL);
+    atomic_fetch_sub(&sem->waiters, 1);
+}
+
+/// @brief Increments semaphore and wakes one parked process, if any
+void Sem_post(Sem *sem) {
+    atomic_fetch_add(&sem->value, 1);
+    if (atomic_load(&sem->waiters) > 0)
+        futex_wake(&sem->value, 1);
+}
+#else
+/// @brief Initializes semaphore
+/// @return 0 on success, -1 on failure
+int Sem_init(Sem *sem, int pshared, u_int value) {
+    return sem_init(sem, pshared, value);
+}
+
+/// @brief Destroys semaphore
+/// @return 0 on success, -1 on failure
+int Sem_destroy(Sem *sem) {
+    return sem_destroy(sem);
+}
+
+/// @brief Decrements semaphore if its value is above zero
+/// @return true if semaphore was decremented
+bool Sem_try(Sem *sem) {
+    while (sem_trywait(sem) == -1)
+        if (errno != EINTR)
+            return false;
+    return true;
+}
+
+/// @brief Decrements semaphore, blocks while its value is zero
+void Sem_wait(Sem *sem) {
+    while (sem_wait(sem) == -1)
+        if (errno != EINTR)
+            error("Failed to wait on semaphore");
+}
+
+/// @brief Increments semaphore
+void Sem_post(Sem *sem) {
+    if (sem_post(sem) == -1)
+        error("Failed to post semaphore");
+}
+#endif
+
 /// @brief Checks if number is in range
 /// @param num Number to check
 /// @param min Minimum value
@@ -124,33 +839,242 @@ int parse_int_arg(char* arg) {
     }
 }
 
-/// @brief Initiates process sleep for random time between min and max
-/// @param min Minimum sleep time in seconds
-/// @param max Maximum sleep time in seconds
-void random_sleep(int min, int max) {
-    SET_RANDOM
-    int time = RAND(min, max); // NOLINT(cert-msc50-cpp)
-    usleep(time * 1000);
+/// @brief Derives state of actor's random generator from program's seed
+/// @param seed Program's seed
+/// @param actor Who the generator is for
+/// @param id Actor's number, 0 for post office
+/// @return Generator's state, never 0
+uint64_t random_init(uint64_t seed, enum Actor actor, u_int id) {
+    // splitmix64, so that neighbouring actors get unrelated states
+    uint64_t state = seed ^ ((uint64_t)actor << 32 | id);
+    state += 0x9E3779B97F4A7C15;
+    state = (state ^ (state >> 30)) * 0xBF58476D1CE4E5B9;
+    state = (state ^ (state >> 27)) * 0x94D049BB133111EB;
+    state ^= state >> 31;
+    return state ? state : 1;
+}
+
+/// @brief Advances xorshift64* generator
+/// @param random Generator's state
+/// @return Random 32-bit number
+uint32_t random_next(uint64_t *random) {
+    uint64_t state = *random;
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    *random = state;
+    return (state * 0x2545F4914F6CDD1D) >> 32;
 }
 
 /// @brief Generates random integer between min and max
+/// @param random Generator's state
 /// @param min Minimum value
 /// @param max Maximum value
-int random_int(int min, int max) {
-    SET_RANDOM
-    return RAND(min, max); // NOLINT(cert-msc50-cpp)
+int random_int(uint64_t *random, int min, int max) {
+    return min + (int)(((uint64_t)random_next(random) * (uint32_t)(max - min + 1)) >> 32);
+}
+
+/// @brief Generates random number from exponential distribution
+/// @param random Generator's state
+/// @param mean Mean of the distribution
+double random_exponential(uint64_t *random, double mean) {
+    // Uniform in (0, 1), so that logarithm is finite
+    double uniform = (random_next(random) + 0.5) / 4294967296.0;
+    return -mean * log(uniform);
+}
+
+/// @brief Generates random number from standard normal distribution
+/// @param random Generator's state
+double random_normal(uint64_t *random) {
+    // Box-Muller transform
+    double u = (random_next(random) + 0.5) / 4294967296.0;
+    double v = (random_next(random) + 0.5) / 4294967296.0;
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+/// @brief Generates time of service
+/// @param memory Program's shared memory
+/// @param random Generator's state
+/// @param service Type of service (1..services)
+/// @return Time of service in microseconds
+int random_service_time(SharedMemory *memory, uint64_t *random, int service) {
+    const ServiceTime *time = &memory->args.service_times[service - 1];
+    double us;
+
+    switch (time->type) {
+        case SD_UNIFORM:
+            return random_int(random, 0, (int)time->time) * 1000;
+        case SD_FIXED:
+            us = time->time * 1000;
+            break;
+        case SD_EXPONENTIAL:
+            us = random_exponential(random, time->time * 1000);
+            break;
+        default:
+            // Mean of log-normal distribution is exp(mu + sigma^2 / 2)
+            us = exp(log(time->time * 1000) - time->sigma * time->sigma / 2 + time->sigma * random_normal(random));
+            break;
+    }
+    return us < INT_MAX ? (int)us : INT_MAX;
+}
+
+/// @brief Sleeps until monotonic time
+/// @param deadline Time to wake up at in nanoseconds, see monotonic_ns()
+void sleep_until(uint64_t deadline) {
+    struct timespec ts = {.tv_sec = deadline / 1000000000, .tv_nsec = deadline % 1000000000};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        continue;
+}
+
+/// @brief Returns current time of the simulation
+/// @param memory Program's shared memory
+/// @return Virtual time in virtual time mode, monotonic time otherwise, in nanoseconds
+uint64_t clock_ns(SharedMemory *memory) {
+    return memory->args.virtual_time ? memory->virtual_time : monotonic_ns();
+}
+
+/// @brief Returns histogram's bucket of a value
+size_t histogram_bucket(uint64_t value) {
+    if (value < (1 << HISTOGRAM_SUB_BITS))
+        return value;
+
+    // Values with the same highest bit share 2^HISTOGRAM_SUB_BITS buckets
+    int exponent = 63 - __builtin_clzll(value);
+    size_t sub = (value >> (exponent - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    return ((size_t)(exponent - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) + sub;
+}
+
+/// @brief Returns the middle of histogram's bucket
+uint64_t histogram_value(size_t bucket) {
+    if (bucket < (1 << HISTOGRAM_SUB_BITS))
+        return bucket;
+
+    int exponent = (int)(bucket >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    uint64_t lowest = ((uint64_t)(1 << HISTOGRAM_SUB_BITS) + sub) << (exponent - HISTOGRAM_SUB_BITS);
+    return lowest + ((uint64_t)1 << (exponent - HISTOGRAM_SUB_BITS)) / 2;
+}
+
+/// @brief Adds value to histogram, if latency is measured
+/// @param memory Program's shared memory
+/// @param type Histogram to add value to
+/// @param value Measured value
+void record_latency(SharedMemory *memory, enum HistogramType type, uint64_t value) {
+    if (!memory->args.latency)
+        return;
+
+    Histogram *histogram = &memory->histograms[type];
+    atomic_fetch_add_explicit(&histogram->counts[histogram_bucket(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->total, 1, memory_order_relaxed);
+}
+
+/// @brief Returns value below which given fraction of histogram's values lie
+/// @param histogram Histogram to look into
+/// @param fraction Fraction of values (0..1)
+uint64_t histogram_percentile(Histogram *histogram, double fraction) {
+    uint64_t total = atomic_load(&histogram->total);
+    uint64_t rank = (uint64_t)(fraction * total + 0.5);
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        if (seen >= rank)
+            return histogram_value(i);
+    }
+    return 0;
 }
 
+/// @brief Prints percentiles of all latency histograms to stderr
+/// @param memory Program's shared memory
+void print_latencies(SharedMemory *memory) {
+    static const char *names[HT_COUNT] = {
+        [HT_WAIT] = "wait_ms",
+        [HT_SERVICE] = "service_ms",
+        [HT_BREAK] = "break_ms",
+        [HT_UTILIZATION] = "utilization_%"
+    };
+    // Durations are kept in nanoseconds, utilization in hundredths of percent
+    static const double units[HT_COUNT] = {
+        [HT_WAIT] = 1e6,
+        [HT_SERVICE] = 1e6,
+        [HT_BREAK] = 1e6,
+        [HT_UTILIZATION] = 100
+    };
+
+    for (int i = 0; i < HT_COUNT; i++) {
+        Histogram *histogram = &memory->histograms[i];
+        fprintf(stderr, "%s: count=%llu p50=%.3f p99=%.3f p999=%.3f\n", names[i],
+                (unsigned long long)atomic_load(&histogram->total),
+                histogram_percentile(histogram, 0.5) / units[i],
+                histogram_percentile(histogram, 0.99) / units[i],
+                histogram_percentile(histogram, 0.999) / units[i]);
+    }
+}
+
+#ifdef SEM_STATS
+/// @brief Decrements semaphore like Sem_wait() and counts the wait
+/// @param sem Semaphore to wait on
+/// @param stats Contention of the semaphore
+/// @note Uncontended waits are not timed, so they cost one extra atomic
+void Sem_wait_counted(Sem *sem, SemStats *stats) {
+    atomic_fetch_add_explicit(&stats->acquisitions, 1, memory_order_relaxed);
+    if (Sem_try(sem))
+        return;
+
+    uint64_t start = monotonic_ns();
+    Sem_wait(sem);
+    uint64_t waited = monotonic_ns() - start;
+
+    atomic_fetch_add_explicit(&stats->contended, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->wait_ns, waited, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&stats->max_wait_ns, memory_order_relaxed);
+    while (waited > max && !atomic_compare_exchange_weak_explicit(&stats->max_wait_ns, &max, waited,
+                                                                   memory_order_relaxed, memory_order_relaxed));
+}
+
+/// @brief Initializes contention of one semaphore
+/// @param stats Contention to initialize
+void SemStats_init(SemStats *stats) {
+    atomic_init(&stats->acquisitions, 0);
+    atomic_init(&stats->contended, 0);
+    atomic_init(&stats->wait_ns, 0);
+    atomic_init(&stats->max_wait_ns, 0);
+}
+
+/// @brief Prints contention of one semaphore to stderr
+/// @param name Name of the semaphore
+/// @param stats Contention of the semaphore
+void print_sem(const char *name, SemStats *stats) {
+    uint64_t acquisitions = atomic_load(&stats->acquisitions);
+    uint64_t contended = atomic_load(&stats->contended);
+    fprintf(stderr, "sem %s: acquisitions=%llu contended=%llu (%.1f%%) wait_ms=%.3f max_wait_ms=%.3f\n", name,
+            (unsigned long long)acquisitions, (unsigned long long)contended,
+            acquisitions ? 100.0 * contended / acquisitions : 0.0,
+            atomic_load(&stats->wait_ns) / 1e6, atomic_load(&stats->max_wait_ns) / 1e6);
+}
+
+/// @brief Prints contention of all semaphores to stderr
+/// @param memory Program's shared memory
+void print_sem_stats(SharedMemory *memory) {
+    print_sem("mutex", &memory->sem_stats.mutex);
+    print_sem("output", &memory->sem_stats.output);
+    print_sem("work", &memory->sem_stats.work);
+}
+#endif
+
 /// @brief Initializes all semaphores in SharedMemory
 /// @param memory SharedMemory to initialize
 void Semaphores_init(SharedMemory *memory) {
     INIT_SEM(memory->mutex, 1, 1);
     INIT_SEM(memory->output, 1, 1);
-    INIT_SEM(memory->leaving, 1, 0);
-    INIT_SEM(memory->post_closed, 1, 0);
-
-    for (int i = 0; i < 3; i++)
-        INIT_SEM(memory->queue_sem[i], 1, 0);
+    INIT_SEM(memory->work, 1, 0);
+#ifdef SEM_STATS
+    SemStats_init(&memory->sem_stats.mutex);
+    SemStats_init(&memory->sem_stats.output);
+    SemStats_init(&memory->sem_stats.work);
+#endif
 }
 
 /// @brief Destroys all semaphores in SharedMemory
@@ -158,363 +1082,2713 @@ void Semaphores_init(SharedMemory *memory) {
 void Semaphores_destroy(SharedMemory *memory) {
     DEST_SEM(memory->mutex);
     DEST_SEM(memory->output);
-    DEST_SEM(memory->leaving);
-    DEST_SEM(memory->post_closed);
-
-    for (int i = 0; i < 3; i++)
-        DEST_SEM(memory->queue_sem[i]);
+    DEST_SEM(memory->work);
 }
 
-/// @brief Initializes SharedMemory
-/// @return Pointer to initialized SharedMemory
+/// @brief Writes whole buffer to file descriptor
+/// @param fd File descriptor
+/// @param buffer Data to write
+/// @param size Size of data
 /// @note Exits with EXIT_FAILURE if error occurred
-SharedMemory* SharedMemory_init(void) {
-    SharedMemory *memory = mmap(NULL, sizeof(SharedMemory), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-    if (memory == MAP_FAILED)
-        error("Failed to allocate memory");
+void write_all(int fd, const char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, buffer, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            error("Failed to write output file");
+        }
+        buffer += written;
+        size -= written;
+    }
+}
 
-    memory->lines_count = 0;
-    memory->post_open = 1;
+/// @brief Log writer's thread, writes lines or records from log ring to output file in their order
+/// @param arg SharedMemory
+void* log_writer(void *arg) {
+    SharedMemory *memory = arg;
+    int fd = fileno(memory->file);
+    bool is_binary = memory->args.log_mode == LOG_BINARY;
 
-    memory->file = fopen("proj2.out", "w");
-    if (memory->file == NULL)
-        error("Failed to open output file");
+    char buffer[LOG_BUFFER_SIZE];
+    size_t used = 0;
+    size_t next = 0;
 
-    Semaphores_init(memory);
-    return memory;
-}
+    while (true) {
+        LogSlot *slot = &memory->log_ring[next % LOG_RING_SIZE];
+
+        // Line is ready, move it to buffer and free the slot
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) == next + 1) {
+            size_t length = is_binary ? sizeof(TraceEntry) : strlen(slot->line);
+            if (used + length > sizeof(buffer)) {
+                write_all(fd, buffer, used);
+                used = 0;
+            }
+            memcpy(buffer + used, is_binary ? (const char *)&slot->entry : slot->line, length);
+            used += length;
 
-/// @brief Destroys SharedMemory
-/// @param memory SharedMemory to destroy
-void SharedMemory_destroy(SharedMemory *memory) {
-    Semaphores_destroy(memory);
-    fclose(memory->file);
-    if (munmap(memory, sizeof(SharedMemory)) == -1)
-        error("Failed to free memory");
-}
+            atomic_store_explicit(&slot->seq, next + LOG_RING_SIZE, memory_order_release);
+            next++;
+            continue;
+        }
 
-/// @brief Logs client's action
-/// @param memory SharedMemory to get output file
-/// @param id Client's number (1..NU)
-/// @param service Type of service (1..3), 0 if no service
-/// @param action Client's action
-void log_client(SharedMemory* memory, u_int id, u_int service, enum ClientAction action) {
-    sem_wait(&memory->output);
+        // Ring is empty, write what we have and wait for more lines
+        write_all(fd, buffer, used);
+        used = 0;
 
-    switch(action) {
-        case CA_STARTED:
-            fprintf(memory->file, "%ld: Z %d: started\n", ++memory->lines_count, id);
-            break;
-        case CA_ENTERING_OFFICE:
-            fprintf(memory->file, "%ld: Z %d: entering office for a service %d\n", ++memory->lines_count, id, service);
-            break;
-        case CA_CALLED_BY_WORKER:
-            fprintf(memory->file, "%ld: Z %d: called by office worker\n", ++memory->lines_count, id);
-            break;
-        case CA_FINISHED:
-            fprintf(memory->file, "%ld: Z %d: going home\n", ++memory->lines_count, id);
+        if (atomic_load(&memory->log_done) && next == atomic_load(&memory->lines_count))
             break;
+        usleep(1000);
     }
 
-    fflush(memory->file);
-
-    sem_post(&memory->output);
+    return NULL;
 }
 
-/// @brief Logs worker's action
-/// @param memory SharedMemory to get output file
-/// @param id Worker's number (1..NZ)
-/// @param service Type of service (1..3), 0 if no service
-/// @param action Worker's action
-void log_worker(SharedMemory* memory, u_int id, u_int service, enum WorkerAction action) {
-    sem_wait(&memory->output);
+/// @brief Allocates log ring and starts log writer
+/// @param memory SharedMemory to initialize log ring in
+/// @note Exits with EXIT_FAILURE if error occurred
+void LogRing_init(SharedMemory *memory) {
+    memory->log_ring = mmap(NULL, LOG_RING_SIZE * sizeof(LogSlot), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory->log_ring == MAP_FAILED)
+        error("Failed to allocate memory");
 
-    switch(action) {
-        case WA_STARTED:
-            fprintf(memory->file, "%ld: U %d: started\n", ++memory->lines_count, id);
-            break;
-        case WA_SERVING_START:
-            fprintf(memory->file, "%ld: U %d: serving a service of type %d\n", ++memory->lines_count, id, service);
-            break;
-        case WA_SERVING_END:
-            fprintf(memory->file, "%ld: U %d: service finished\n", ++memory->lines_count, id);
-            break;
-        case WA_BREAK_START:
-            fprintf(memory->file, "%ld: U %d: taking break\n", ++memory->lines_count, id);
-            break;
-        case WA_BREAK_END:
-            fprintf(memory->file, "%ld: U %d: break finished\n", ++memory->lines_count, id);
-            break;
-        case WA_FINISHED:
-            fprintf(memory->file, "%ld: U %d: going home\n", ++memory->lines_count, id);
-            break;
-    }
+    // Slot i is free for line i + 1
+    for (size_t i = 0; i < LOG_RING_SIZE; i++)
+        atomic_init(&memory->log_ring[i].seq, i);
 
-    fflush(memory->file);
+    atomic_init(&memory->log_done, false);
+    if (pthread_create(&memory->log_writer, NULL, log_writer, memory) != 0)
+        error("Failed to create a thread");
+}
+
+/// @brief Waits for log writer to write all lines and frees log ring
+/// @param memory SharedMemory to destroy log ring in
+void LogRing_destroy(SharedMemory *memory) {
+    atomic_store(&memory->log_done, true);
+    pthread_join(memory->log_writer, NULL);
 
-    sem_post(&memory->output);
+    if (munmap(memory->log_ring, LOG_RING_SIZE * sizeof(LogSlot)) == -1)
+        error("Failed to free memory");
+    memory->log_ring = NULL;
 }
 
-/// @brief Logs post office's action
-/// @param memory SharedMemory to get output file
-/// @note Post has only one function - closing
-void log_office(SharedMemory* memory) {
-    sem_wait(&memory->output);
+/// @brief Maps output file into memory, so lines can be copied straight into it
+/// @param memory SharedMemory to initialize log map in
+/// @note Exits with EXIT_FAILURE if error occurred
+void LogMap_init(SharedMemory *memory) {
+    // File stays sparse, so only the written part takes space
+    int fd = fileno(memory->file);
+    if (ftruncate(fd, LOG_MAP_SIZE) == -1)
+        error("Failed to resize output file");
+
+    memory->log_map = mmap(NULL, LOG_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (memory->log_map == MAP_FAILED)
+        error("Failed to map output file");
+    atomic_init(&memory->log_position, 0);
+}
 
-    fprintf(memory->file, "%ld: closing\n", ++memory->lines_count);
-    fflush(memory->file);
+/// @brief Unmaps output file and truncates it to its real length
+/// @param memory SharedMemory to destroy log map in
+void LogMap_destroy(SharedMemory *memory) {
+    if (munmap(memory->log_map, LOG_MAP_SIZE) == -1)
+        error("Failed to free memory");
+    memory->log_map = NULL;
 
-    sem_post(&memory->output);
+    if (ftruncate(fileno(memory->file), atomic_load(&memory->log_position) >> LOG_SEQ_BITS) == -1)
+        error("Failed to resize output file");
 }
 
-/// @brief Client's process
+/// @brief Returns amount of events logged so far, taken from line numbering of the log
 /// @param memory Program's shared memory
-/// @param id Client's number (1..NU)
-/// @param TZ Maximum time to sleep before entering the office
-void process_client(SharedMemory *memory, u_int id, int TZ) {
-    log_client(memory, id, 0, CA_STARTED);
-    PRINT("[C] Client %d started\n", id);
-
-    // Sleep before entering the office
-    random_sleep(0, TZ);
-
-    // Select a service
-    int service = random_int(1, 3);
-
-    // Check synchronously if post office is open
-    // Otherwise, we can encounter a situation
-    // when client is trying to enter the post after
-    // it's closed
-    bool is_post_open;
-    sem_wait(&memory->mutex);
-    is_post_open = memory->post_open;
-    sem_post(&memory->mutex);
-
-    if (is_post_open && (is_post_open == memory->post_open)) {
-        PRINT("[C] Post: %d; Client %d; Service: %d; Entering office\n", memory->post_open, id, service);
-        // Increment queue for selected service
-        sem_wait(&memory->mutex);
-        memory->queue[service - 1]++;
-        sem_post(&memory->mutex);
-
-        log_client(memory, id, service, CA_ENTERING_OFFICE);
-    } else {
-        PRINT("[C] Post: %d; Client %d; Service: %d; Finished\n", memory->post_open, id, service);
-        log_client(memory, id, service, CA_FINISHED);
-        exit(EXIT_SUCCESS);
+size_t logged_events(SharedMemory *memory) {
+    if (memory->log_map)
+        return atomic_load(&memory->log_position) & LOG_SEQ_MASK;
+    return atomic_load(&memory->lines_count);
+}
+
+/// @brief Compares arrival times for qsort()
+int compare_arrivals(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/// @brief Computes arrival time of every client
+/// @param args Program's arguments
+/// @return Sorted array of NZ arrival times since start in nanoseconds, NULL in AM_UNIFORM model
+/// @note Exits with EXIT_FAILURE if arrival trace can't be read
+uint64_t* arrivals_init(const Arguments *args) {
+    if (args->arrivals == AM_UNIFORM)
+        return NULL;
+
+    uint64_t *arrivals = malloc(args->NZ * sizeof(uint64_t));
+    if (arrivals == NULL)
+        error("Failed to allocate memory");
+
+    if (args->arrivals == AM_POISSON) {
+        // Generator of the arrivals, no client has number 0
+        uint64_t random = random_init(args->seed, ACTOR_CLIENT, 0);
+        double time = 0;
+        for (int i = 0; i < args->NZ; i++) {
+            time += random_exponential(&random, 1e9 / args->arrival_rate);
+            arrivals[i] = (uint64_t)time;
+        }
+        return arrivals;
     }
 
-    // Wait for worker to call client
-    sem_wait(&memory->queue_sem[service - 1]);
+    FILE *file = fopen(args->arrival_trace, "r");
+    if (file == NULL)
+        error("Failed to open arrival trace");
 
-    // Get serviced for random time
-    PRINT("[C] Post: %d; Client %d; Service: %d; Called by worker\n", memory->post_open, id, service);
-    log_client(memory, id, service, CA_CALLED_BY_WORKER);
-    random_sleep(0, 10);
-    log_client(memory, id, service, CA_FINISHED);
+    for (int i = 0; i < args->NZ; i++) {
+        double time;
+        if (fscanf(file, "%lf", &time) != 1 || time < 0)
+            error("Arrival trace has less than NZ valid arrivals");
+        arrivals[i] = (uint64_t)(time * 1e6);
+    }
+    fclose(file);
 
-    PRINT("[C] Post: %d; Client %d; Service: %d; Finished\n", memory->post_open, id, service);
-    exit(EXIT_SUCCESS);
+    // Clients are numbered in order of their arrivals
+    qsort(arrivals, args->NZ, sizeof(uint64_t), compare_arrivals);
+    return arrivals;
 }
 
-/// @brief Checks if there are any clients waiting in queues
-/// @param memory Program's shared memory
-bool check_queues(SharedMemory *memory) {
-    return memory->queue[0] > 0 || memory->queue[1] > 0 || memory->queue[2] > 0;
+/// @brief Returns name of shared memory with live statistics of this process
+/// @param name Buffer for the name
+/// @param size Size of buffer
+void stats_name(char *name, size_t size) {
+    snprintf(name, size, STATS_NAME "%d", (int)getpid());
 }
 
-/// @brief Worker's process
-/// @param memory Program's shared memory
-/// @param id Worker's number (1..NU)
-/// @param TU Maximum time to sleep before starting work
-void process_worker(SharedMemory *memory, u_int id, int TU) {
-    log_worker(memory, id, 0, WA_STARTED);
-    PRINT("[W] Worker %d started\n", id);
+/// @brief Allocates live statistics
+/// @param args Program's arguments
+/// @return Statistics, named shared memory if they are published, anonymous otherwise
+/// @note Exits with EXIT_FAILURE if error occurred
+Stats* Stats_init(const Arguments *args) {
+    int fd = -1;
+    if (args->stats) {
+        char name[32];
+        stats_name(name, sizeof(name));
+        fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd == -1 || ftruncate(fd, sizeof(Stats)) == -1)
+            error("Failed to create statistics");
+    }
 
-    bool has_clients;    // if there are any customers waiting = 1, else = 0
-    bool post_open;           // if office is open = 1, else = 0
-    bool is_leaving = false;      // if office semaphore is posted = 1, else = 0
+    Stats *stats = mmap(NULL, sizeof(Stats), PROT_READ | PROT_WRITE, MAP_SHARED | (fd == -1 ? MAP_ANONYMOUS : 0), fd, 0);
+    if (stats == MAP_FAILED)
+        error("Failed to allocate memory");
+    if (fd != -1)
+        close(fd);
+
+    stats->pid = getpid();
+    stats->services = args->services;
+    stats->started = monotonic_ns();
+    atomic_init(&stats->events, 0);
+    atomic_init(&stats->first_event_at, 0);
+    atomic_init(&stats->last_event_at, 0);
+    atomic_init(&stats->served, 0);
+    atomic_init(&stats->turned_away, 0);
+    atomic_init(&stats->rss_kb, 0);
+    atomic_init(&stats->serving, 0);
+    atomic_init(&stats->on_break, 0);
+    atomic_init(&stats->idle, 0);
+    atomic_init(&stats->closed, false);
+    atomic_init(&stats->closed_at, 0);
+    atomic_init(&stats->finished, false);
+    for (int i = 0; i < MAX_SERVICES; i++)
+        atomic_init(&stats->queues[i].count, 0);
+    return stats;
+}
 
-    while (true) {
-        sem_wait(&memory->mutex);
-        has_clients = check_queues(memory);
-        post_open = memory->post_open;
-        sem_post(&memory->mutex);
+/// @brief Marks statistics finished and frees them
+/// @param stats Statistics to destroy
+void Stats_destroy(Stats *stats) {
+    atomic_store(&stats->finished, true);
 
-        PRINT("[W] Post: %d; Worker %d; Customers waiting: [%d, %d, %d];\n", post_open, id, memory->queue[0], memory->queue[1], memory->queue[2]);
+    // Readers that already opened the name keep their mapping
+    if (stats->pid == (uint32_t)getpid()) {
+        char name[32];
+        stats_name(name, sizeof(name));
+        shm_unlink(name);
+    }
+    if (munmap(stats, sizeof(Stats)) == -1)
+        error("Failed to free memory");
+}
 
-        // If any of the queues are not empty
-        if (has_clients) {
-            PRINT("[W] Post: %d; Worker %d; Customers waiting: %d; Serving started\n", post_open, id, has_clients);
+/// Real time of the first event and of the last client going home logged by this process or thread,
+/// 0 before them, merged into Stats by stats_merge_active()
+_Thread_local uint64_t first_event_at = 0;
+_Thread_local uint64_t last_event_at = 0;
 
-            // Choose a queue
-            // Randomly at first, then just first not empty queue
-            int queue = random_int(1, 3);
-            if (memory->queue[queue - 1] == 0)
-                for (queue = 1; queue <= 3; queue++)
-                    if (memory->queue[queue - 1]) break;
+/// @brief Counts logged events and stretches the interval from the first event to the last client's event over them
+/// @param memory Program's shared memory
+/// @param time Time of the events, see clock_ns()
+/// @param count Amount of events
+/// @param actor Who did the events, enum Actor
+/// @param action What they did, enum ClientAction or enum WorkerAction
+/// @note Going home is the last event of every client; closing and workers going home come only after
+///       the office's sleep, so they don't end the interval
+/// @note Interval is kept per process or thread, the only shared write is the optional live count
+void stats_events(SharedMemory *memory, uint64_t time, u_int count, int actor, int action) {
+    if (memory->args.stats)
+        atomic_fetch_add_explicit(&memory->stats->events, count, memory_order_relaxed);
+
+    bool is_last = actor == ACTOR_CLIENT && action == CA_FINISHED;
+    if (first_event_at != 0 && !is_last)
+        return;
+    // Interval is in real time even in virtual time mode, so that it says how fast events are logged
+    if (memory->args.virtual_time)
+        time = monotonic_ns();
+    if (first_event_at == 0)
+        first_event_at = time;
+    if (is_last && time > last_event_at)
+        last_event_at = time;
+}
 
-            PRINT("[W] Post: %d; Worker %d; Chosen queue: %d\n", post_open, id, queue);
+/// @brief Merges interval of events logged by this process or thread into Stats
+/// @param memory Program's shared memory
+/// @note Called once when the process or thread finishes
+void stats_merge_active(SharedMemory *memory) {
+    Stats *stats = memory->stats;
+    uint64_t first = atomic_load(&stats->first_event_at);
+    while (first_event_at != 0 && (first == 0 || first_event_at < first)
+           && !atomic_compare_exchange_weak(&stats->first_event_at, &first, first_event_at));
+    uint64_t last = atomic_load(&stats->last_event_at);
+    while (last_event_at > last && !atomic_compare_exchange_weak(&stats->last_event_at, &last, last_event_at));
+}
 
-            sem_wait(&memory->mutex);
-            memory->queue[queue - 1]--;
-            sem_post(&memory->mutex);
+/// @brief Adds to counter of live statistics, if they are published
+/// @param memory Program's shared memory
+/// @param counter Counter to change
+/// @param value Value to add, negative to subtract
+void stats_add(SharedMemory *memory, atomic_int *counter, int value) {
+    if (memory->args.stats)
+        atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
 
-            // Let customer in the queue enter the office
-            sem_post(&memory->queue_sem[queue - 1]);
+#ifdef DEBUG
+/// @brief Allocates debug rings of all actors and dumps them if a process crashes
+/// @param args Program's arguments
+/// @note Exits with EXIT_FAILURE if error occurred
+void DebugLog_init(const Arguments *args) {
+    // Rings are touched only by actors that print something
+    size_t count = 2 + (size_t)args->NU + args->NZ;
+    size_t size = sizeof(DebugLog) + count * sizeof(DebugRing);
+    DebugLog *log = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (log == MAP_FAILED)
+        error("Failed to allocate memory");
 
-            // Start serving
-            PRINT("[W] Post: %d; Worker %d; Service: %d; Serving\n", post_open, id, queue);
-            log_worker(memory, id, queue, WA_SERVING_START);
-            random_sleep(0, 10);
-            log_worker(memory, id, queue, WA_SERVING_END);
-            PRINT("[W] Post: %d; Worker %d; Service: %d; Serving done\n", post_open, id, queue);
+    log->size = size;
+    log->started = monotonic_ns();
+    atomic_init(&log->is_dumped, false);
+    log->count = count;
+    log->workers = args->NU;
+    debug_log = log;
+    // Caller is the main thread
+    debug_ring = &log->rings[0];
+
+    static const int signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGINT, SIGTERM};
+    for (size_t i = 0; i < sizeof(signals) / sizeof(*signals); i++)
+        sigaction(signals[i], &(struct sigaction){.sa_handler = debug_signal}, NULL);
+}
+
+/// @brief Dumps and frees debug rings
+void DebugLog_destroy(void) {
+    debug_dump();
+    DebugLog *log = debug_log;
+    debug_log = NULL;
+    if (munmap(log, log->size) == -1)
+        error("Failed to free memory");
+}
+#endif
+
+/// @brief Allocates online checker
+/// @param args Program's arguments
+/// @return Checker, NULL if events are not checked
+/// @note Exits with EXIT_FAILURE if error occurred
+Checker* Checker_init(const Arguments *args) {
+    if (!args->check)
+        return NULL;
+
+    size_t size = sizeof(Checker) + (size_t)args->NZ + 1 + args->NU + 1;
+    Checker *checker = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (checker == MAP_FAILED)
+        error("Failed to allocate memory");
+
+    checker->size = size;
+    checker->main = getpid();
+    atomic_init(&checker->is_closed, false);
+    for (int i = 0; i <= MAX_SERVICES; i++) {
+        atomic_init(&checker->called[i], 0);
+        atomic_init(&checker->served[i], 0);
+    }
+    return checker;
+}
+
+/// @brief Frees online checker
+/// @param checker Checker to free, may be NULL
+void Checker_destroy(Checker *checker) {
+    if (checker && munmap(checker, checker->size) == -1)
+        error("Failed to free memory");
+}
+
+/// @brief Reports violated invariant and aborts the whole simulation
+/// @param memory Program's shared memory
+/// @param record Event that violates it
+/// @param state State of event's actor before the event
+/// @param msg Description of the violation
+void check_failed(SharedMemory *memory, const TraceRecord *record, int state, const char *msg) {
+    char line[LOG_SLOT_SIZE];
+    format_record(line, sizeof(line), record);
+    // Event without its line number and new line
+    const char *event = strchr(line, ' ') + 1;
+    fprintf(stderr, "[CHECK] %s: event \"%.*s\" in state %d, %llu events logged before\n", msg,
+            (int)strcspn(event, "\n"), event, state,
+            (unsigned long long)logged_events(memory));
+
+    // Children die with their parents, see fork_actor()
+    if (memory->checker->main != getpid())
+        kill(memory->checker->main, SIGABRT);
+    abort();
+}
+
+/// @brief Validates event before it's logged
+/// @param memory Program's shared memory
+/// @param record Event to validate
+/// @note Aborts the simulation on violation, see check_failed()
+void check_event(SharedMemory *memory, const TraceRecord *record) {
+    Checker *checker = memory->checker;
+    const Arguments *args = &memory->args;
+    uint8_t *state = &checker->states[record->actor == ACTOR_WORKER ? args->NZ + 1 + record->id : record->id];
+    int before = *state;
+
+    if (record->actor == ACTOR_CLIENT) {
+        switch (record->action) {
+            case CA_STARTED:
+                if (before != CC_NONE)
+                    check_failed(memory, record, before, "Client started twice");
+                *state = CC_STARTED;
+                break;
+            case CA_ENTERING_OFFICE:
+                if (before != CC_STARTED)
+                    check_failed(memory, record, before, "Client entered without starting");
+                if (atomic_load(&checker->is_closed))
+                    check_failed(memory, record, before, "Client entered after closing");
+                *state = CC_ENTERED;
+                break;
+            case CA_CALLED_BY_WORKER: {
+                if (before != CC_ENTERED)
+                    check_failed(memory, record, before, "Client called without entering");
+                // Worker calls the ticket just before it logs serving, so at most NU calls are not logged yet
+                uint64_t called = atomic_fetch_add(&checker->called[record->service], 1) + 1;
+                if (called > atomic_load(&checker->served[record->service]) + args->NU)
+                    check_failed(memory, record, before, "Client called while no worker serves its service");
+                *state = CC_CALLED;
+                break;
+            }
+            case CA_FINISHED:
+                if (before != CC_STARTED && before != CC_CALLED)
+                    check_failed(memory, record, before, "Client went home while waiting in queue");
+                *state = CC_HOME;
+                break;
+        }
+    } else if (record->actor == ACTOR_WORKER) {
+        switch (record->action) {
+            case WA_STARTED:
+                if (before != CW_NONE)
+                    check_failed(memory, record, before, "Worker started twice");
+                *state = CW_IDLE;
+                break;
+            case WA_SERVING_START:
+                if (before != CW_IDLE)
+                    check_failed(memory, record, before, "Worker started serving while not idle");
+                atomic_fetch_add(&checker->served[record->service], 1);
+                *state = CW_SERVING;
+                break;
+            case WA_SERVING_END:
+                if (before != CW_SERVING)
+                    check_failed(memory, record, before, "Worker finished service it didn't start");
+                *state = CW_IDLE;
+                break;
+            case WA_BREAK_START:
+                if (before != CW_IDLE)
+                    check_failed(memory, record, before, "Worker took break while not idle");
+                if (atomic_load(&checker->is_closed))
+                    check_failed(memory, record, before, "Worker took break after closing");
+                *state = CW_BREAK;
+                break;
+            case WA_BREAK_END:
+                if (before != CW_BREAK)
+                    check_failed(memory, record, before, "Worker finished break it didn't take");
+                *state = CW_IDLE;
+                break;
+            case WA_FINISHED:
+                if (before != CW_IDLE)
+                    check_failed(memory, record, before, "Worker went home while not idle");
+                if (!atomic_load(&checker->is_closed))
+                    check_failed(memory, record, before, "Worker went home before closing");
+                *state = CW_HOME;
+                break;
+        }
+    } else if (atomic_load(&checker->is_closed)) {
+        check_failed(memory, record, 0, "Post office closed twice");
+    }
+}
+
+/// @brief Validates state at the end of simulation
+/// @param memory Program's shared memory
+/// @note Aborts on violation, see check_failed()
+void check_end(SharedMemory *memory) {
+    Checker *checker = memory->checker;
+    const Arguments *args = &memory->args;
+    TraceRecord office = {.actor = ACTOR_OFFICE};
+    if (!atomic_load(&checker->is_closed))
+        check_failed(memory, &office, 0, "Post office never closed");
+
+    for (int i = 1; i <= args->NZ; i++) {
+        TraceRecord client = {.id = i, .actor = ACTOR_CLIENT, .action = CA_FINISHED};
+        if (checker->states[i] != CC_HOME)
+            check_failed(memory, &client, checker->states[i], "Client never went home");
+    }
+    for (int i = 1; i <= args->NU; i++) {
+        TraceRecord worker = {.id = i, .actor = ACTOR_WORKER, .action = WA_FINISHED};
+        if (checker->states[args->NZ + 1 + i] != CW_HOME)
+            check_failed(memory, &worker, checker->states[args->NZ + 1 + i], "Worker never went home");
+    }
+    for (int i = 1; i <= args->services; i++) {
+        TraceRecord serving = {.id = 0, .actor = ACTOR_WORKER, .action = WA_SERVING_START, .service = i};
+        if (atomic_load(&checker->called[i]) != atomic_load(&checker->served[i]))
+            check_failed(memory, &serving, 0, "Served services don't match called clients");
+    }
+}
+
+/// @brief Forks process of an actor, when events are checked it dies together with its parent
+/// @param memory Program's shared memory
+/// @return As fork() does
+pid_t fork_actor(SharedMemory *memory) {
+    pid_t parent = getpid();
+    pid_t pid = fork();
+#ifdef DEBUG
+    // Main thread's ring stays with the main thread, child selects ring of the actor it runs
+    if (pid == 0)
+        debug_ring = NULL;
+#endif
+    if (pid == 0 && memory->checker) {
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        // Parent may have died before the signal was set
+        if (getppid() != parent)
+            _exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+/// @brief Ends process of an actor, adds its peak RSS to the footprint of the simulation
+/// @param memory Program's shared memory
+void exit_actor(SharedMemory *memory) {
+    stats_merge_active(memory);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    atomic_fetch_add_explicit(&memory->stats->rss_kb, usage.ru_maxrss, memory_order_relaxed);
+    exit(EXIT_SUCCESS);
+}
+
+/// @brief Returns amount of clients run by one executor
+/// @param args Program's arguments with executors
+u_int executor_block(const Arguments *args) {
+    return (args->NZ + args->executors - 1) / args->executors;
+}
+
+/// @brief Allocates inboxes of executors, if clients are run by them
+/// @param memory SharedMemory to set inboxes in
+/// @note Exits with EXIT_FAILURE if error occurred
+void Executors_init(SharedMemory *memory) {
+    const Arguments *args = &memory->args;
+    memory->inboxes = NULL;
+    memory->inbox_next = NULL;
+    if (args->executors == 0 || args->threads > 0)
+        return;
+
+    size_t size = args->executors * sizeof(ExecutorInbox) + args->NZ * sizeof(int);
+    ExecutorInbox *inboxes = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (inboxes == MAP_FAILED)
+        error("Failed to allocate memory");
+
+    for (int i = 0; i < args->executors; i++) {
+        atomic_init(&inboxes[i].head, -1);
+        atomic_init(&inboxes[i].bell, 0);
+        atomic_init(&inboxes[i].is_waiting, false);
+    }
+    memory->inboxes = inboxes;
+    memory->inbox_next = (int*)&inboxes[args->executors];
+}
+
+/// @brief Frees inboxes of executors
+/// @param memory SharedMemory with inboxes
+void Executors_destroy(SharedMemory *memory) {
+    const Arguments *args = &memory->args;
+    if (memory->inboxes && munmap(memory->inboxes, args->executors * sizeof(ExecutorInbox) + args->NZ * sizeof(int)) == -1)
+        error("Failed to free memory");
+}
+
+/// @brief Reads CPUs of one NUMA node from sysfs
+/// @param node Node's number
+/// @param cpus Set to fill with node's CPUs
+/// @return false if there's no such node
+bool read_node_cpus(int node, cpu_set_t *cpus) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+
+    char list[4096];
+    bool has_list = fgets(list, sizeof(list), file) != NULL;
+    fclose(file);
+
+    // Ranges like 0-3,8-11
+    CPU_ZERO(cpus);
+    for (char *next = list; has_list && *next >= '0' && *next <= '9';) {
+        long first = strtol(next, &next, 10), last = first;
+        if (*next == '-')
+            last = strtol(next + 1, &next, 10);
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, cpus);
+        if (*next == ',')
+            next++;
+    }
+    return true;
+}
+
+/// @brief Finds NUMA nodes and their CPUs the program may run on, if actors are pinned
+/// @param args Program's arguments
+/// @return Topology shared with forked children, NULL if actors are not pinned
+/// @note Without NUMA in sysfs all allowed CPUs make one node
+/// @note Exits with EXIT_FAILURE if error occurred
+Topology* Topology_init(const Arguments *args) {
+    if (!args->pin || args->threads > 0)
+        return NULL;
+
+    Topology *topology = mmap(NULL, sizeof(Topology), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (topology == MAP_FAILED)
+        error("Failed to allocate memory");
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+        error("Failed to get CPU affinity");
+
+    topology->nodes = 0;
+    for (int node = 0; node < MAX_NODES; node++) {
+        cpu_set_t *cpus = &topology->cpus[topology->nodes];
+        if (!read_node_cpus(node, cpus))
+            continue;
+        CPU_AND(cpus, cpus, &allowed);
+        if (CPU_COUNT(cpus) == 0)
+            continue;
+        topology->node_ids[topology->nodes] = node;
+        topology->cpus_count[topology->nodes] = CPU_COUNT(cpus);
+        atomic_init(&topology->workers[topology->nodes], 0);
+        topology->nodes++;
+    }
+
+    if (topology->nodes == 0) {
+        topology->nodes = 1;
+        topology->node_ids[0] = 0;
+        topology->cpus[0] = allowed;
+        topology->cpus_count[0] = CPU_COUNT(&allowed);
+        atomic_init(&topology->workers[0], 0);
+    }
+    return topology;
+}
+
+/// @brief Frees topology
+/// @param topology Topology to free, NULL if actors are not pinned
+void Topology_destroy(Topology *topology) {
+    if (topology && munmap(topology, sizeof(Topology)) == -1)
+        error("Failed to free memory");
+}
+
+/// @brief Returns node serving the queue
+/// @param topology NUMA nodes actors are pinned to
+/// @param queue Queue number (1..services)
+/// @return Node's index in topology (0..nodes-1)
+int queue_node(const Topology *topology, int queue) {
+    return (queue - 1) % topology->nodes;
+}
+
+/// @brief Pins calling process to CPUs of the node
+/// @param topology NUMA nodes actors are pinned to
+/// @param node Node's index in topology (0..nodes-1)
+void pin_to_node(const Topology *topology, int node) {
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &topology->cpus[node]) == -1)
+        error("Failed to set CPU affinity");
+}
+
+/// @brief Pins calling worker to one core of the node serving its preferred queue
+/// @param topology NUMA nodes actors are pinned to
+/// @param preferred Worker's preferred queue (1..services)
+/// @note Workers of one node take its cores in turns, more workers than cores share them
+void pin_worker(Topology *topology, int preferred) {
+    int node = queue_node(topology, preferred);
+    int index = atomic_fetch_add(&topology->workers[node], 1) % topology->cpus_count[node];
+
+    cpu_set_t cpu;
+    CPU_ZERO(&cpu);
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &topology->cpus[node]) && index-- == 0) {
+            CPU_SET(i, &cpu);
+            break;
+        }
+    }
+    if (sched_setaffinity(0, sizeof(cpu), &cpu) == -1)
+        error("Failed to set CPU affinity");
+}
+
+/// @brief Moves ticket slots of every queue to the node serving it
+/// @param memory Program's shared memory with initialized queues
+/// @note Only whole pages of every queue's slots are moved, on failure, e.g. in huge pages, they stay where they are
+void bind_queues(SharedMemory *memory) {
+    const Topology *topology = memory->topology;
+    if (topology == NULL || topology->nodes < 2)
+        return;
+
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    for (int i = 0; i < memory->args.services; i++) {
+        const ServiceQueue *queue = &memory->queues[i];
+        uintptr_t start = ((uintptr_t)queue->slots + page - 1) / page * page;
+        uintptr_t end = (uintptr_t)(queue->slots + memory->args.NZ) / page * page;
+        unsigned long nodes = 1UL << topology->node_ids[queue_node(topology, i + 1)];
+        if (start < end)
+            syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, &nodes, sizeof(nodes) * CHAR_BIT + 1, MPOL_MF_MOVE);
+    }
+}
+
+/// @brief Maps anonymous memory shared with forked children
+/// @param args Program's arguments, they select huge pages and pre-faulting
+/// @param size Size of the mapping, rounded up to the mapped size
+/// @return Mapping, MAP_FAILED on failure
+/// @note Mapping is sparse, only touched pages get backed, unless it's pre-faulted
+void* map_shared(const Arguments *args, size_t *size) {
+    int flags = MAP_SHARED | MAP_ANONYMOUS | (args->prefault ? MAP_POPULATE : MAP_NORESERVE);
+
+    if (args->huge_pages) {
+        size_t huge_size = (*size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        // Reserved, so that mapping fails instead of faulting when there aren't enough huge pages
+        void *memory = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, (flags & ~MAP_NORESERVE) | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            *size = huge_size;
+            return memory;
+        }
+
+        // No huge pages are reserved, transparent ones must be asked for before the pages are faulted in
+        memory = mmap(NULL, *size, PROT_READ | PROT_WRITE, flags & ~MAP_POPULATE, -1, 0);
+        if (memory == MAP_FAILED)
+            return memory;
+        madvise(memory, *size, MADV_HUGEPAGE);
+        if (args->prefault) {
+            size_t page = sysconf(_SC_PAGESIZE);
+            for (size_t i = 0; i < *size; i += page)
+                ((volatile char*)memory)[i] = 0;
+        }
+        return memory;
+    }
+
+    return mmap(NULL, *size, PROT_READ | PROT_WRITE, flags, -1, 0);
+}
+
+/// @brief Initializes SharedMemory
+/// @param args Program's arguments
+/// @return Pointer to initialized SharedMemory
+/// @note Exits with EXIT_FAILURE if error occurred
+SharedMemory* SharedMemory_init(const Arguments *args) {
+    // Ticket slots are touched only as far as tickets are taken, the rest never gets backed by pages
+    size_t size = sizeof(SharedMemory) + args->services * (sizeof(ServiceQueue) + (size_t)args->NZ * sizeof(TicketSlot));
+    // Pre-faulted pages are allocated and zeroed before any child is forked, children only map them on first touch
+    SharedMemory *memory = map_shared(args, &size);
+    if (memory == MAP_FAILED)
+        error("Failed to allocate memory");
+
+    memory->size = size;
+    memory->args = *args;
+    memory->pool = NULL;
+    memory->virtual_time = 0;
+    atomic_init(&memory->lines_count, 0);
+    memory->log_ring = NULL;
+    memory->log_map = NULL;
+    memory->arrivals = arrivals_init(args);
+    memory->stats = Stats_init(args);
+    memory->checker = Checker_init(args);
+    Executors_init(memory);
+    memory->topology = Topology_init(args);
+#ifdef DEBUG
+    DebugLog_init(args);
+#endif
+    atomic_init(&memory->post_open, true);
+    atomic_init(&memory->open_sections, 0);
+    atomic_init(&memory->is_closed, 0);
+    atomic_init(&memory->idle_workers, 0);
+    atomic_init(&memory->queues_mask, 0);
+    // Ticket slots follow the queues, anonymous mapping is already zeroed
+    TicketSlot *slots = (TicketSlot*)&memory->queues[args->services];
+    for (int i = 0; i < args->services; i++) {
+        ServiceQueue *queue = &memory->queues[i];
+        atomic_init(&queue->count, 0);
+        atomic_init(&queue->tail, 0);
+        atomic_init(&queue->head, 0);
+        queue->slots = slots + (size_t)i * args->NZ;
+    }
+    bind_queues(memory);
+
+    memory->file = fopen(args->output, "w+");
+    if (memory->file == NULL)
+        error("Failed to open output file");
+
+    Semaphores_init(memory);
+    if (args->log_mode == LOG_MMAP)
+        LogMap_init(memory);
+    else if (args->log_mode != LOG_STDIO)
+        LogRing_init(memory);
+    return memory;
+}
+
+/// @brief Destroys SharedMemory
+/// @param memory SharedMemory to destroy
+/// @note All lines must be logged already
+void SharedMemory_destroy(SharedMemory *memory) {
+    if (memory->log_ring)
+        LogRing_destroy(memory);
+    if (memory->log_map)
+        LogMap_destroy(memory);
+    Semaphores_destroy(memory);
+    fclose(memory->file);
+    free(memory->arrivals);
+    Stats_destroy(memory->stats);
+    Checker_destroy(memory->checker);
+    Executors_destroy(memory);
+    Topology_destroy(memory->topology);
+#ifdef DEBUG
+    DebugLog_destroy();
+#endif
+    if (munmap(memory, memory->size) == -1)
+        error("Failed to free memory");
+}
+
+/// @brief Formats event as a line, truncates it if it doesn't fit
+/// @param line Buffer to format line into
+/// @param size Size of buffer
+/// @param record Event to format
+/// @return Length of the line
+size_t format_line(char *line, size_t size, const TraceRecord *record) {
+    size_t length = format_record(line, size, record);
+
+    // Keep space for the new line, even if line got truncated
+    if (length >= size) {
+        length = size - 1;
+        line[length - 1] = '\n';
+    }
+    return length;
+}
+
+/// @brief Puts event into log ring, waits for a free slot if ring is full
+/// @param memory SharedMemory to get log ring
+/// @param record Event to log, its seq is set here
+void log_ring_record(SharedMemory* memory, TraceRecord *record) {
+    // Line number also decides the slot
+    size_t seq = atomic_fetch_add(&memory->lines_count, 1) + 1;
+    LogSlot *slot = &memory->log_ring[(seq - 1) % LOG_RING_SIZE];
+
+    // Slot still holds a line that log writer hasn't written
+    while (atomic_load_explicit(&slot->seq, memory_order_acquire) != seq - 1)
+        sched_yield();
+
+    record->seq = seq;
+    if (memory->args.log_mode == LOG_BINARY) {
+        // Line number is the entry's place in trace, clock of virtual time starts at zero
+        slot->entry = trace_entry(record, memory->args.virtual_time ? 0 : memory->stats->started);
+    } else {
+        format_line(slot->line, sizeof(slot->line), record);
+    }
+
+    atomic_store_explicit(&slot->seq, seq, memory_order_release);
+}
+
+/// @brief Copies event's line into memory-mapped output file
+/// @param memory SharedMemory to get log map
+/// @param record Event to log, its seq is set here
+/// @note Exits with EXIT_FAILURE if output file is full
+void log_map_record(SharedMemory* memory, TraceRecord *record) {
+    char line[LOG_SLOT_SIZE];
+    size_t length;
+
+    // Line number and its place in file are reserved at once,
+    // so lines are in the file in the same order as they're numbered
+    uint64_t position = atomic_load(&memory->log_position);
+    uint64_t next;
+    do {
+        record->seq = (position & LOG_SEQ_MASK) + 1;
+        length = format_line(line, sizeof(line), record);
+
+        uint64_t end = (position >> LOG_SEQ_BITS) + length;
+        if (record->seq > LOG_SEQ_MASK || end > LOG_MAP_SIZE - 1)
+            error("Output file is full");
+        next = end << LOG_SEQ_BITS | record->seq;
+    } while (!atomic_compare_exchange_weak(&memory->log_position, &position, next));
+
+    memcpy(memory->log_map + (position >> LOG_SEQ_BITS), line, length);
+}
+
+/// @brief Logs event to the output file, numbered by its order
+/// @param memory SharedMemory to get output file
+/// @param actor Who did the action
+/// @param id Actor's number, 0 for post office
+/// @param service Type of service (1..services), 0 if no service
+/// @param action Actor's action
+void log_event(SharedMemory* memory, enum Actor actor, u_int id, u_int service, int action) {
+    TraceRecord record = {
+        .time = clock_ns(memory),
+        .id = id,
+        .actor = actor,
+        .action = action,
+        .service = service
+    };
+    stats_events(memory, record.time, 1, actor, action);
+    if (memory->checker)
+        check_event(memory, &record);
+
+    if (memory->log_ring) {
+        log_ring_record(memory, &record);
+        return;
+    }
+    if (memory->log_map) {
+        log_map_record(memory, &record);
+        return;
+    }
+
+    WAIT_SEM(memory, output);
+
+    char line[LOG_SLOT_SIZE];
+    record.seq = ++memory->lines_count;
+    format_record(line, sizeof(line), &record);
+    fputs(line, memory->file);
+    fflush(memory->file);
+
+    Sem_post(&memory->output);
+}
+
+/// @brief Logs client's action
+/// @param memory SharedMemory to get output file
+/// @param id Client's number (1..NU)
+/// @param service Type of service (1..services), 0 if no service
+/// @param action Client's action
+void log_client(SharedMemory* memory, u_int id, u_int service, enum ClientAction action) {
+    log_event(memory, ACTOR_CLIENT, id, service, action);
+}
+
+/// @brief Logs worker's action
+/// @param memory SharedMemory to get output file
+/// @param id Worker's number (1..NZ)
+/// @param service Type of service (1..services), 0 if no service
+/// @param action Worker's action
+void log_worker(SharedMemory* memory, u_int id, u_int service, enum WorkerAction action) {
+    log_event(memory, ACTOR_WORKER, id, service, action);
+}
+
+/// @brief Logs post office's action
+/// @param memory SharedMemory to get output file
+/// @note Post has only one function - closing
+void log_office(SharedMemory* memory) {
+    log_event(memory, ACTOR_OFFICE, 0, 0, 0);
+    // Events checked from now on are surely logged after closing
+    if (memory->checker)
+        atomic_store(&memory->checker->is_closed, true);
+}
+
+/// @brief Logs start of clients with consecutive numbers at once
+/// @param memory SharedMemory to get output file
+/// @param first Number of the first client (1..NZ)
+/// @param count Amount of clients (1..CLIENT_BATCH)
+void log_clients_started(SharedMemory* memory, u_int first, u_int count) {
+    TraceRecord record = {.time = clock_ns(memory), .actor = ACTOR_CLIENT, .action = CA_STARTED};
+
+    // Ring slots are taken one by one anyway, and count and check the events themselves
+    if (memory->log_ring) {
+        for (u_int i = 0; i < count; i++)
+            log_client(memory, first + i, 0, CA_STARTED);
+        return;
+    }
+
+    if (memory->checker) {
+        for (u_int i = 0; i < count; i++) {
+            record.id = first + i;
+            check_event(memory, &record);
+        }
+    }
+
+    stats_events(memory, record.time, count, ACTOR_CLIENT, CA_STARTED);
+
+    char lines[CLIENT_BATCH * LOG_SLOT_SIZE];
+    size_t length;
+
+    // All lines and their place in file are reserved with one compare-and-swap
+    if (memory->log_map) {
+        uint64_t position = atomic_load(&memory->log_position);
+        uint64_t next;
+        do {
+            length = 0;
+            for (u_int i = 0; i < count; i++) {
+                record.seq = (position & LOG_SEQ_MASK) + i + 1;
+                record.id = first + i;
+                length += format_line(lines + length, LOG_SLOT_SIZE, &record);
+            }
+
+            uint64_t end = (position >> LOG_SEQ_BITS) + length;
+            if (record.seq > LOG_SEQ_MASK || end > LOG_MAP_SIZE - 1)
+                error("Output file is full");
+            next = end << LOG_SEQ_BITS | record.seq;
+        } while (!atomic_compare_exchange_weak(&memory->log_position, &position, next));
+
+        memcpy(memory->log_map + (position >> LOG_SEQ_BITS), lines, length);
+        return;
+    }
+
+    // One lock and one flush for all lines
+    WAIT_SEM(memory, output);
+
+    length = 0;
+    for (u_int i = 0; i < count; i++) {
+        record.seq = ++memory->lines_count;
+        record.id = first + i;
+        length += format_line(lines + length, LOG_SLOT_SIZE, &record);
+    }
+    fwrite(lines, 1, length, memory->file);
+    fflush(memory->file);
+
+    Sem_post(&memory->output);
+}
+
+/// FIFO of pool's task numbers with fixed capacity
+typedef struct task_queue {
+    int *tasks;
+    size_t head;
+    size_t size;
+    size_t capacity;
+} TaskQueue;
+
+/// Pool's counterpart of a semaphore \n
+/// Parks waiting tasks instead of blocking pool's threads
+typedef struct task_sem {
+    int count;
+    TaskQueue parked;
+} TaskSem;
+
+/// Task sleeping until its deadline
+typedef struct timer {
+    // Time of the simulation in nanoseconds, see clock_ns()
+    uint64_t deadline;
+    // Timers with the same deadline expire in order they were added
+    uint64_t order;
+    int task;
+} Timer;
+
+/// Min-heap of timers
+typedef struct timer_heap {
+    Timer *timers;
+    size_t count;
+    // Order of the next added timer
+    uint64_t order;
+} TimerHeap;
+
+/// Hashed timer wheel of executor's sleeping clients \n
+/// Client is appended to the slot of its deadline's tick and moved to ready list once the slot is visited after
+/// the deadline, so adding and expiring a timer takes O(1) instead of heap's O(log n); deadlines further than
+/// the wheel spans stay in their slot for more rounds \n
+/// Clients expire in order of their slots, within one slot in order they were added
+typedef struct timer_wheel {
+    // First and last client of every slot, -1 if slot is empty
+    int *heads;
+    int *tails;
+    // Next client in the same slot or in ready list for every client
+    int *next;
+    // Deadline of every sleeping client in nanoseconds, see monotonic_ns()
+    uint64_t *deadlines;
+    // Earliest tick that may still have expired clients, earlier ticks were already visited
+    uint64_t tick;
+    // Clients in slots
+    size_t count;
+    // First and last client whose wait is over, -1 if there's none
+    int ready_head;
+    int ready_tail;
+} TimerWheel;
+
+/// Fixed pool of threads running clients, workers and post office as tasks \n
+/// Tasks 0..NZ-1 are clients, NZ..NZ+NU-1 are workers, NZ+NU is post office \n
+/// In virtual time mode, pool has one thread that jumps to the next deadline instead of sleeping
+typedef struct pool {
+    // Guards everything below
+    pthread_mutex_t lock;
+    // Signaled when a task becomes ready, a timer is added or all tasks finished
+    pthread_cond_t cond;
+
+    SharedMemory *memory;
+    pthread_t *threads;
+
+    size_t tasks_count;
+    // Tasks that haven't finished yet
+    size_t remaining;
+    Client *clients;
+    Worker *workers;
+    Office office;
+    // Task has made its first step
+    bool *started;
+
+    // Tasks ready to make a step
+    TaskQueue ready;
+    // Sleeping tasks
+    TimerHeap timers;
+
+    // Counterpart of work, clients park in their ticket slots
+    TaskSem work;
+    // Workers waiting for post office to log closing
+    TaskQueue closing;
+} Pool;
+
+/// @brief Allocates TaskQueue
+/// @param queue TaskQueue to initialize
+/// @param capacity Max amount of tasks in queue
+void TaskQueue_init(TaskQueue *queue, size_t capacity) {
+    queue->tasks = malloc(capacity * sizeof(int));
+    if (queue->tasks == NULL)
+        error("Failed to allocate memory");
+    queue->head = 0;
+    queue->size = 0;
+    queue->capacity = capacity;
+}
+
+/// @brief Appends task to the end of TaskQueue
+void TaskQueue_push(TaskQueue *queue, int task) {
+    queue->tasks[(queue->head + queue->size++) % queue->capacity] = task;
+}
+
+/// @brief Removes task from the front of TaskQueue
+/// @return Removed task
+int TaskQueue_pop(TaskQueue *queue) {
+    int task = queue->tasks[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->size--;
+    return task;
+}
+
+/// @brief Compares timers by their expiration
+/// @return true if timer a expires before timer b
+bool Timer_before(const Timer *a, const Timer *b) {
+    return a->deadline < b->deadline || (a->deadline == b->deadline && a->order < b->order);
+}
+
+/// @brief Adds sleeping task to timers
+/// @param heap Timers, there must be room for one more
+/// @param deadline Time to wake task up at
+/// @param task Sleeping task
+void TimerHeap_push(TimerHeap *heap, uint64_t deadline, int task) {
+    Timer timer = {deadline, heap->order++, task};
+
+    size_t i = heap->count++;
+    while (i > 0 && Timer_before(&timer, &heap->timers[(i - 1) / 2])) {
+        heap->timers[i] = heap->timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap->timers[i] = timer;
+}
+
+/// @brief Removes the earliest timer
+/// @param heap Timers, must not be empty
+/// @return Task of removed timer
+int TimerHeap_pop(TimerHeap *heap) {
+    int task = heap->timers[0].task;
+    Timer last = heap->timers[--heap->count];
+
+    size_t i = 0;
+    while (2 * i + 1 < heap->count) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < heap->count && Timer_before(&heap->timers[child + 1], &heap->timers[child]))
+            child++;
+        if (!Timer_before(&heap->timers[child], &last))
+            break;
+        heap->timers[i] = heap->timers[child];
+        i = child;
+    }
+    heap->timers[i] = last;
+    return task;
+}
+
+/// @brief Allocates empty timer wheel
+/// @param wheel TimerWheel to initialize
+/// @param capacity Amount of clients, they are numbered 0..capacity-1
+/// @param now Current time in nanoseconds
+void TimerWheel_init(TimerWheel *wheel, size_t capacity, uint64_t now) {
+    wheel->heads = malloc(WHEEL_SLOTS * sizeof(int));
+    wheel->tails = malloc(WHEEL_SLOTS * sizeof(int));
+    wheel->next = malloc(capacity * sizeof(int));
+    wheel->deadlines = malloc(capacity * sizeof(uint64_t));
+    if (wheel->heads == NULL || wheel->tails == NULL || wheel->next == NULL || wheel->deadlines == NULL)
+        error("Failed to allocate memory");
+
+    for (int i = 0; i < WHEEL_SLOTS; i++)
+        wheel->heads[i] = wheel->tails[i] = -1;
+    wheel->tick = now / WHEEL_TICK_NS;
+    wheel->count = 0;
+    wheel->ready_head = wheel->ready_tail = -1;
+}
+
+/// @brief Frees timer wheel
+void TimerWheel_destroy(TimerWheel *wheel) {
+    free(wheel->heads);
+    free(wheel->tails);
+    free(wheel->next);
+    free(wheel->deadlines);
+}
+
+/// @brief Appends client whose wait is over to ready list
+/// @param wheel Timer wheel
+/// @param task Client that isn't in any slot
+void TimerWheel_ready(TimerWheel *wheel, int task) {
+    wheel->next[task] = -1;
+    if (wheel->ready_tail == -1)
+        wheel->ready_head = task;
+    else
+        wheel->next[wheel->ready_tail] = task;
+    wheel->ready_tail = task;
+}
+
+/// @brief Adds sleeping client
+/// @param wheel Timer wheel
+/// @param deadline Time to wake client up at in nanoseconds, see monotonic_ns()
+/// @param task Sleeping client
+void TimerWheel_add(TimerWheel *wheel, uint64_t deadline, int task) {
+    // Ticks before the current one won't be visited again until the next round
+    uint64_t tick = deadline / WHEEL_TICK_NS;
+    if (tick < wheel->tick) {
+        TimerWheel_ready(wheel, task);
+        return;
+    }
+
+    int slot = tick % WHEEL_SLOTS;
+    wheel->deadlines[task] = deadline;
+    wheel->next[task] = -1;
+    if (wheel->tails[slot] == -1)
+        wheel->heads[slot] = task;
+    else
+        wheel->next[wheel->tails[slot]] = task;
+    wheel->tails[slot] = task;
+    wheel->count++;
+}
+
+/// @brief Moves clients whose deadline passed from visited slots to ready list
+/// @param wheel Timer wheel
+/// @param now Current time in nanoseconds
+/// @note Current tick stays to be visited again, its later clients haven't expired yet
+void TimerWheel_expire(TimerWheel *wheel, uint64_t now) {
+    uint64_t tick = now / WHEEL_TICK_NS;
+    // After a whole round every slot was visited
+    uint64_t last = tick - wheel->tick < WHEEL_SLOTS ? tick : wheel->tick + WHEEL_SLOTS - 1;
+
+    for (uint64_t visited = wheel->tick; wheel->count > 0 && visited <= last; visited++) {
+        int slot = visited % WHEEL_SLOTS;
+        int task = wheel->heads[slot], kept_tail = -1;
+        wheel->heads[slot] = -1;
+        while (task != -1) {
+            int next = wheel->next[task];
+            if (wheel->deadlines[task] <= now) {
+                wheel->count--;
+                TimerWheel_ready(wheel, task);
+            } else {
+                // Keep it in the slot for a later tick or round
+                wheel->next[task] = -1;
+                if (kept_tail == -1)
+                    wheel->heads[slot] = task;
+                else
+                    wheel->next[kept_tail] = task;
+                kept_tail = task;
+            }
+            task = next;
+        }
+        wheel->tails[slot] = kept_tail;
+    }
+    wheel->tick = tick;
+}
+
+/// @brief Removes the first client whose wait is over
+/// @param wheel Timer wheel
+/// @return The client, -1 if there's none
+int TimerWheel_pop(TimerWheel *wheel) {
+    int task = wheel->ready_head;
+    if (task != -1) {
+        wheel->ready_head = wheel->next[task];
+        if (wheel->ready_head == -1)
+            wheel->ready_tail = -1;
+    }
+    return task;
+}
+
+/// @brief Returns time when the next client may expire
+/// @param wheel Timer wheel with clients in slots
+/// @return Time in nanoseconds, not later than any deadline, UINT64_MAX if no client sleeps
+/// @note Deadline of the first non-empty slot, or its end if its clients are in later rounds
+uint64_t TimerWheel_next(const TimerWheel *wheel) {
+    if (wheel->count == 0)
+        return UINT64_MAX;
+
+    for (uint64_t tick = wheel->tick; ; tick++) {
+        int task = wheel->heads[tick % WHEEL_SLOTS];
+        if (task == -1)
             continue;
+
+        uint64_t next = (tick + 1) * WHEEL_TICK_NS;
+        for (; task != -1; task = wheel->next[task])
+            if (wheel->deadlines[task] < next)
+                next = wheel->deadlines[task];
+        return next;
+    }
+}
+
+/// @brief Adds sleeping task to pool's timers
+/// @note Pool's lock must be held
+void Pool_add_timer(Pool *pool, uint64_t deadline, int task) {
+    TimerHeap_push(&pool->timers, deadline, task);
+}
+
+/// @brief Makes task ready to make a step
+/// @note Pool's lock must be held
+void Pool_wake(Pool *pool, int task) {
+    TaskQueue_push(&pool->ready, task);
+    pthread_cond_signal(&pool->cond);
+}
+
+/// @brief Posts pool's work semaphore, wakes the first parked task if any
+/// @param pool Pool to post semaphore in
+void Pool_post(Pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+
+    TaskSem *sem = &pool->work;
+    if (sem->parked.size > 0)
+        Pool_wake(pool, TaskQueue_pop(&sem->parked));
+    else
+        sem->count++;
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/// @brief Takes next ticket in queue
+/// @param memory Program's shared memory
+/// @param queue Queue number (1..services)
+/// @return Client's ticket, must be passed to wait_ticket()
+u_int take_ticket(SharedMemory *memory, int queue) {
+    return atomic_fetch_add(&memory->queues[queue - 1].tail, 1);
+}
+
+/// @brief Returns slot of ticket in queue
+/// @param memory Program's shared memory
+/// @param queue Queue number (1..services)
+/// @param ticket Ticket from take_ticket()
+TicketSlot* ticket_slot(SharedMemory *memory, int queue, u_int ticket) {
+    return &memory->queues[queue - 1].slots[ticket];
+}
+
+/// @brief Pushes client whose ticket was called to its executor's inbox and wakes the executor
+/// @param memory Program's shared memory
+/// @param index Client's index (0..NZ-1)
+void executor_push(SharedMemory *memory, int index) {
+    ExecutorInbox *inbox = &memory->inboxes[index / executor_block(&memory->args)];
+
+    int head = atomic_load(&inbox->head);
+    do {
+        memory->inbox_next[index] = head;
+    } while (!atomic_compare_exchange_weak(&inbox->head, &head, index));
+
+    // Executor sets is_waiting before it checks inbox, so it either sees the push or gets woken up
+    atomic_fetch_add(&inbox->bell, 1);
+    if (atomic_load(&inbox->is_waiting))
+        futex_wake(&inbox->bell, 1);
+}
+
+/// @brief Calls client with the next ticket in queue, the one that waits the longest
+/// @param memory Program's shared memory
+/// @param queue Queue number (1..services)
+/// @param service_time Time of service client gets, in microseconds
+void call_ticket(SharedMemory *memory, int queue, u_int service_time) {
+    u_int ticket = atomic_fetch_add(&memory->queues[queue - 1].head, 1);
+    TicketSlot *slot = ticket_slot(memory, queue, ticket);
+
+    Pool *pool = memory->pool;
+    if (pool) {
+        pthread_mutex_lock(&pool->lock);
+        slot->service_time = service_time;
+        atomic_store(&slot->called, 1);
+        if (slot->is_parked)
+            Pool_wake(pool, slot->task);
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+
+    // Service time is visible to client once it sees the ticket called
+    slot->service_time = service_time;
+    if (memory->inboxes) {
+        // Executor learns about the call from its inbox if client is parked, or by itself when it parks
+        if (atomic_exchange(&slot->called, 1) == TICKET_PARKED)
+            executor_push(memory, slot->task);
+        return;
+    }
+    atomic_store(&slot->called, 1);
+    futex_wake(&slot->called, 1);
+}
+
+/// @brief Blocks calling process until its ticket is called
+/// @param memory Program's shared memory
+/// @param queue Queue number (1..services)
+/// @param ticket Client's ticket from take_ticket()
+void wait_ticket(SharedMemory *memory, int queue, u_int ticket) {
+    TicketSlot *slot = ticket_slot(memory, queue, ticket);
+
+    while (atomic_load(&slot->called) == 0)
+        futex_wait(&slot->called, 0, NULL);
+}
+
+/// @brief Releases one worker that is waiting for work
+/// @param memory Program's shared memory
+/// @note Clients waiting in queue are called by call_ticket()
+void signal_work(SharedMemory *memory) {
+    if (memory->pool)
+        Pool_post(memory->pool);
+    else
+        Sem_post(&memory->work);
+}
+
+/// @brief Lets all workers know that closing is logged, ends their breaks and waits for closing
+/// @param memory Program's shared memory
+void broadcast_closed(SharedMemory *memory) {
+    Pool *pool = memory->pool;
+    if (pool == NULL) {
+        atomic_store(&memory->is_closed, 1);
+        futex_wake(&memory->is_closed, INT_MAX);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    atomic_store(&memory->is_closed, 1);
+
+    while (pool->closing.size > 0)
+        Pool_wake(pool, TaskQueue_pop(&pool->closing));
+
+    // Workers on break wake up now, timers are added again with new deadlines
+    uint64_t now = clock_ns(memory);
+    size_t count = pool->timers.count;
+    pool->timers.count = 0;
+    for (size_t i = 0; i < count; i++) {
+        Timer timer = pool->timers.timers[i];
+        int worker = timer.task - memory->args.NZ;
+        if (worker >= 0 && worker < memory->args.NU && pool->workers[worker].action == WA_BREAK_START)
+            timer.deadline = now;
+        Pool_add_timer(pool, timer.deadline, timer.task);
+    }
+
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/// @brief Puts client into the queue
+/// @param memory Program's shared memory
+/// @param queue Queue number (1..services)
+void enqueue_client(SharedMemory *memory, int queue) {
+    stats_add(memory, &memory->stats->queues[queue - 1].count, 1);
+    atomic_fetch_add(&memory->queues[queue - 1].count, 1);
+    atomic_fetch_or(&memory->queues_mask, (uint64_t)1 << (queue - 1));
+}
+
+/// @brief Wakes one of the workers waiting for work, if there's any
+/// @param memory Program's shared memory
+/// @note Must be called after the queue is incremented
+void wake_idle_worker(SharedMemory *memory) {
+    // Workers are rarely idle, so don't touch the mutex unless some of them are
+    if (atomic_load(&memory->idle_workers) == 0)
+        return;
+
+    WAIT_SEM(memory, mutex);
+    bool wake_worker = memory->idle_workers > 0;
+    if (wake_worker) {
+        memory->idle_workers--;
+        stats_add(memory, &memory->stats->idle, -1);
+    }
+    Sem_post(&memory->mutex);
+
+    if (wake_worker)
+        signal_work(memory);
+}
+
+/// @brief Client's first step
+/// @param memory Program's shared memory
+/// @param client Client's state with id set
+/// @param is_logged Client's start is already logged by log_clients_started()
+/// @return What client waits for before next step
+Wait client_start(SharedMemory *memory, Client *client, bool is_logged) {
+    if (!is_logged)
+        log_client(memory, client->id, 0, CA_STARTED);
+    client->action = CA_STARTED;
+    PRINT("[C] Client %d started\n", client->id);
+
+    // Sleep before entering the office, unless client was started at its arrival time
+    if (memory->arrivals)
+        return (Wait){WT_SLEEP, 0};
+    return (Wait){WT_SLEEP, random_int(&client->random, 0, memory->args.TZ) * 1000};
+}
+
+/// @brief Client's next step, continues from the last logged action
+/// @param memory Program's shared memory
+/// @param client Client's state
+/// @return What client waits for before next step
+Wait client_step(SharedMemory *memory, Client *client) {
+    u_int id = client->id;
+
+    switch (client->action) {
+        case CA_STARTED: {
+            // Select a service
+            int service = random_int(&client->random, 1, memory->args.services);
+            client->service = service;
+
+            // Entering must be queued and logged before closing, so it's done in an open section
+            // that post office waits for, see office_step()
+            atomic_fetch_add(&memory->open_sections, 1);
+            if (atomic_load(&memory->post_open)) {
+                PRINT("[C] Post: %d; Client %d; Service: %d; Entering office\n", memory->post_open, id, service);
+                // Take a ticket, clients are called in order of their tickets
+                client->ticket = take_ticket(memory, service);
+
+                // Increment queue for selected service
+                enqueue_client(memory, service);
+
+                log_client(memory, id, service, CA_ENTERING_OFFICE);
+                client->action = CA_ENTERING_OFFICE;
+                client->entered_at = clock_ns(memory);
+                atomic_fetch_sub(&memory->open_sections, 1);
+
+                // Wake a worker if any of them is idle and wait for worker to call client
+                wake_idle_worker(memory);
+                return (Wait){WT_QUEUE, service};
+            }
+            atomic_fetch_sub(&memory->open_sections, 1);
+
+            PRINT("[C] Post: %d; Client %d; Service: %d; Finished\n", memory->post_open, id, service);
+            log_client(memory, id, service, CA_FINISHED);
+            client->action = CA_FINISHED;
+            if (memory->args.stats)
+                atomic_fetch_add_explicit(&memory->stats->turned_away, 1, memory_order_relaxed);
+            return (Wait){WT_DONE, 0};
+        }
+        case CA_ENTERING_OFFICE: {
+            // Get serviced for as long as worker serves
+            PRINT("[C] Post: %d; Client %d; Service: %d; Called by worker\n", memory->post_open, id, client->service);
+            log_client(memory, id, client->service, CA_CALLED_BY_WORKER);
+            client->action = CA_CALLED_BY_WORKER;
+            record_latency(memory, HT_WAIT, clock_ns(memory) - client->entered_at);
+            if (memory->args.stats)
+                atomic_fetch_add_explicit(&memory->stats->served, 1, memory_order_relaxed);
+            u_int service_time = ticket_slot(memory, client->service, client->ticket)->service_time;
+            return (Wait){WT_SLEEP, (int)service_time};
+        }
+        case CA_CALLED_BY_WORKER:
+            log_client(memory, id, client->service, CA_FINISHED);
+            client->action = CA_FINISHED;
+            PRINT("[C] Post: %d; Client %d; Service: %d; Finished\n", memory->post_open, id, client->service);
+            return (Wait){WT_DONE, 0};
+        case CA_FINISHED:
+            break;
+    }
+
+    return (Wait){WT_DONE, 0};
+}
+
+/// @brief Checks if there are any clients waiting in queues
+/// @param memory Program's shared memory
+bool check_queues(SharedMemory *memory) {
+    return atomic_load(&memory->queues_mask) != 0;
+}
+
+/// @brief Takes one client from the queue, if it isn't empty
+/// @param memory Program's shared memory
+/// @param queue Queue number (1..services)
+/// @return true if client was taken, false if queue is empty
+bool claim_client(SharedMemory *memory, int queue) {
+    atomic_int *count = &memory->queues[queue - 1].count;
+    uint64_t bit = (uint64_t)1 << (queue - 1);
+
+    int current = atomic_load(count);
+    while (current > 0) {
+        if (atomic_compare_exchange_weak(count, &current, current - 1)) {
+            stats_add(memory, &memory->stats->queues[queue - 1].count, -1);
+            // Took the last one, but some client may have entered in the meantime
+            if (current == 1) {
+                atomic_fetch_and(&memory->queues_mask, ~bit);
+                if (atomic_load(count) > 0)
+                    atomic_fetch_or(&memory->queues_mask, bit);
+            }
+            return true;
+        }
+    }
+
+    // Client that entered while the last one was taken may have set the bit after it was cleared
+    if (atomic_load(&memory->queues_mask) & bit) {
+        atomic_fetch_and(&memory->queues_mask, ~bit);
+        if (atomic_load(count) > 0)
+            atomic_fetch_or(&memory->queues_mask, bit);
+    }
+    return false;
+}
+
+/// @brief Claims client from one of the queues as schedule policy says
+/// @param memory Program's shared memory
+/// @param worker Worker's state
+/// @return Queue number the client was claimed from (1..services), 0 if all queues are empty
+int choose_queue(SharedMemory *memory, Worker *worker) {
+    int services = memory->args.services;
+
+    // Randomly at first, then just first not empty queue
+    if (memory->args.schedule == SP_RANDOM) {
+        int queue = random_int(&worker->random, 1, services);
+        if (claim_client(memory, queue))
+            return queue;
+
+        for (uint64_t mask = atomic_load(&memory->queues_mask); mask; mask &= mask - 1) {
+            queue = __builtin_ctzll(mask) + 1;
+            if (claim_client(memory, queue))
+                return queue;
+        }
+        return 0;
+    }
+
+    // Own queue at first, so worker keeps taking clients from the same cache line
+    if (claim_client(memory, worker->preferred))
+        return worker->preferred;
+
+    // Then steal from the queues after the own one, so idle workers spread over the others
+    for (int i = 1; i < services; i++) {
+        int queue = (worker->preferred - 1 + i) % services + 1;
+        if ((atomic_load(&memory->queues_mask) >> (queue - 1) & 1) && claim_client(memory, queue))
+            return queue;
+    }
+    return 0;
+}
+
+/// @brief Worker's next step, finishes the last logged action and decides what to do next
+/// @param memory Program's shared memory
+/// @param worker Worker's state
+/// @return What worker waits for before next step
+Wait worker_step(SharedMemory *memory, Worker *worker) {
+    u_int id = worker->id;
+
+    switch (worker->action) {
+        case WA_SERVING_START:
+            log_worker(memory, id, worker->service, WA_SERVING_END);
+            worker->action = WA_SERVING_END;
+            stats_add(memory, &memory->stats->serving, -1);
+            worker->busy_ns += clock_ns(memory) - worker->action_at;
+            record_latency(memory, HT_SERVICE, clock_ns(memory) - worker->action_at);
+            PRINT("[W] Post: %d; Worker %d; Service: %d; Serving done\n", memory->post_open, id, worker->service);
+            break;
+        case WA_BREAK_START:
+            log_worker(memory, id, 0, WA_BREAK_END);
+            worker->action = WA_BREAK_END;
+            stats_add(memory, &memory->stats->on_break, -1);
+            record_latency(memory, HT_BREAK, clock_ns(memory) - worker->action_at);
+            PRINT("[W] Post: %d; Worker %d; Service: 0; Break done\n", memory->post_open, id);
+            break;
+        case WA_FINISHED:
+            return (Wait){WT_DONE, 0};
+        default:
+            break;
+    }
+
+    bool has_clients;    // if there are any customers waiting = 1, else = 0
+    bool post_open;           // if office is open = 1, else = 0
+
+
+    while (true) {
+        has_clients = check_queues(memory);
+        post_open = atomic_load(&memory->post_open);
+
+        // Worker already had a break and nothing came up, so rather sleep until there's some work
+        if (!has_clients && post_open && worker->action == WA_BREAK_END) {
+            WAIT_SEM(memory, mutex);
+            memory->idle_workers++;
+            stats_add(memory, &memory->stats->idle, 1);
+            // Client might have entered or post might have closed before worker got registered
+            bool has_work = check_queues(memory) || !atomic_load(&memory->post_open);
+            if (has_work) {
+                // Unless somebody already decided to wake this worker up
+                if (memory->idle_workers > 0) {
+                    memory->idle_workers--;
+                    stats_add(memory, &memory->stats->idle, -1);
+                } else
+                    has_work = false;
+            }
+            Sem_post(&memory->mutex);
+
+            if (has_work)
+                continue;
+
+            PRINT("[W] Post: %d; Worker %d; Service: 0; Waiting for work\n", post_open, id);
+            return (Wait){WT_WORK, 0};
+        }
+
+        PRINT("[W] Post: %d; Worker %d; Customers waiting in queues: %#llx;\n", post_open, id, (unsigned long long)memory->queues_mask);
+
+        // If any of the queues are not empty
+        if (has_clients) {
+            PRINT("[W] Post: %d; Worker %d; Customers waiting: %d; Serving started\n", post_open, id, has_clients);
+
+            // Choose a queue
+            int queue = choose_queue(memory, worker);
+
+            // Other workers took all the clients first
+            if (queue == 0)
+                continue;
+
+            PRINT("[W] Post: %d; Worker %d; Chosen queue: %d\n", post_open, id, queue);
+
+            // Let customer in the queue enter the office, both of them spend the same time in service
+            int service_time = random_service_time(memory, &worker->random, queue);
+            call_ticket(memory, queue, service_time);
+
+            // Start serving
+            PRINT("[W] Post: %d; Worker %d; Service: %d; Serving\n", post_open, id, queue);
+            log_worker(memory, id, queue, WA_SERVING_START);
+            worker->action = WA_SERVING_START;
+            stats_add(memory, &memory->stats->serving, 1);
+            worker->action_at = clock_ns(memory);
+            worker->service = queue;
+            return (Wait){WT_SLEEP, service_time};
         }
         // Empty queue, but post is still open
-        if (!has_clients && post_open) {
-            // Ensure that post is still open
-            if (!memory->post_open) {
+        if (post_open) {
+            // Break must be logged before closing, so it's taken in an open section, see office_step()
+            atomic_fetch_add(&memory->open_sections, 1);
+            post_open = atomic_load(&memory->post_open);
+            if (post_open) {
+                PRINT("[W] Post: %d; Worker %d; Service: 0; Taking break\n", post_open, id);
+                log_worker(memory, id, 0, WA_BREAK_START);
+                worker->action = WA_BREAK_START;
+                stats_add(memory, &memory->stats->on_break, 1);
+                worker->action_at = clock_ns(memory);
+            }
+            atomic_fetch_sub(&memory->open_sections, 1);
+
+            if (!post_open) {
                 PRINT("[W] Post: %d; Worker %d; Service: 0; Post closed!\n", post_open, id);
                 continue;
             }
+            return (Wait){WT_BREAK, random_int(&worker->random, 0, memory->args.TU) * 1000};
+        }
 
-            PRINT("[W] Post: %d; Worker %d; Service: 0; Taking break\n", post_open, id);
-            log_worker(memory, id, 0, WA_BREAK_START);
+        // Empty queue and post is closed, but clients that entered before closing may be still queued
+        if (!atomic_load(&memory->is_closed)) {
+            PRINT("[W] Post: %d; Worker %d; Service: 0; Post closed, waiting for closing\n", post_open, id);
+            return (Wait){WT_POST_CLOSED, 0};
+        }
 
-            // Office may be closed during break, so we need to tell worker that it's time to leave
-            if (!memory->post_open) {
-                PRINT("[W] Post: %d; Worker %d; Service: 0; Post closed, sem posted!\n", post_open, id);
-                sem_post(&memory->leaving);
-                is_leaving = 1;
-            }
-            random_sleep(0, TU);
-            log_worker(memory, id, 0, WA_BREAK_END);
-            PRINT("[W] Post: %d; Worker %d; Service: 0; Break done\n", post_open, id);
+        // Nobody enters after closing, so empty queues stay empty
+        if (check_queues(memory))
             continue;
+
+        PRINT("[W] Post: %d; Worker %d; Service: 0; Finished\n", post_open, id);
+        log_worker(memory, id, 0, WA_FINISHED);
+        worker->action = WA_FINISHED;
+
+        uint64_t lifetime = clock_ns(memory) - worker->started_at;
+        record_latency(memory, HT_UTILIZATION, lifetime ? worker->busy_ns * 10000 / lifetime : 0);
+        return (Wait){WT_DONE, 0};
+    }
+}
+
+/// @brief Worker's first step
+/// @param memory Program's shared memory
+/// @param worker Worker's state with id set
+/// @return What worker waits for before next step
+Wait worker_start(SharedMemory *memory, Worker *worker) {
+    log_worker(memory, worker->id, 0, WA_STARTED);
+    worker->action = WA_STARTED;
+    worker->started_at = clock_ns(memory);
+    worker->preferred = (worker->id - 1) % memory->args.services + 1;
+    PRINT("[W] Worker %d started\n", worker->id);
+
+    return worker_step(memory, worker);
+}
+
+/// @brief Post office's first step
+/// @param memory Program's shared memory
+/// @param office Post office's state
+/// @return What post office waits for before next step
+Wait office_start(SharedMemory *memory, Office *office) {
+    PRINT("[M] Randomly sleeping\n");
+
+    // Do that random sleep
+    int F = memory->args.F;
+    return (Wait){WT_SLEEP, random_int(&office->random, F / 2, F) * 1000};
+}
+
+/// @brief Post office's next step, closes the office and lets all workers know at once
+/// @param memory Program's shared memory
+/// @param office Post office's state
+/// @return What post office waits for before next step
+Wait office_step(SharedMemory *memory, Office *office) {
+    if (office->is_closed)
+        return (Wait){WT_DONE, 0};
+
+    PRINT("[M] Done sleeping, closing post\n");
+
+    // Nobody sees the office open from now on, but clients entering and workers taking break
+    // that saw it open a moment ago have to log it before closing
+    atomic_store(&memory->post_open, false);
+    while (atomic_load(&memory->open_sections) > 0)
+        sched_yield();
+
+    // Idle workers either registered before closing or see the office closed
+    WAIT_SEM(memory, mutex);
+    log_office(memory);
+    int idle_workers = memory->idle_workers;
+    memory->idle_workers = 0;
+    atomic_store_explicit(&memory->stats->idle, 0, memory_order_relaxed);
+    atomic_store_explicit(&memory->stats->closed_at, monotonic_ns(), memory_order_relaxed);
+    atomic_store_explicit(&memory->stats->closed, true, memory_order_relaxed);
+    Sem_post(&memory->mutex);
+    office->is_closed = true;
+
+    // Wake everybody at once, workers serve remaining clients and go home
+    broadcast_closed(memory);
+    for (int i = 0; i < idle_workers; i++)
+        signal_work(memory);
+
+    PRINT("[M] Post is closed\n");
+    return (Wait){WT_DONE, 0};
+}
+
+/// @brief Blocks calling process until actor's wait is over
+/// @param memory Program's shared memory
+/// @param wait Actor's wait
+void process_wait(SharedMemory *memory, Wait wait) {
+    switch (wait.type) {
+        case WT_SLEEP:
+            usleep(wait.arg);
+            break;
+        case WT_QUEUE:
+            // Only clients wait in queues, see process_client()
+            break;
+        case WT_POST_CLOSED:
+            while (atomic_load(&memory->is_closed) == 0)
+                futex_wait(&memory->is_closed, 0, NULL);
+            break;
+        case WT_WORK:
+            WAIT_SEM(memory, work);
+            break;
+        case WT_BREAK: {
+            // Sleep, but wake up as soon as closing is logged
+            uint64_t deadline = monotonic_ns() + (uint64_t)wait.arg * 1000;
+            uint64_t now;
+            while (atomic_load(&memory->is_closed) == 0 && (now = monotonic_ns()) < deadline) {
+                struct timespec timeout = {.tv_sec = (deadline - now) / 1000000000, .tv_nsec = (deadline - now) % 1000000000};
+                futex_wait(&memory->is_closed, 0, &timeout);
+            }
+            break;
         }
-        // Empty queue and post is closed - can safely finish
-        if (!has_clients && !post_open) {
-            PRINT("[W] Post: %d; Worker %d; Service: 0; Post closed, preparing to leave\n", post_open, id);
-            // Ensure that there are no customers waiting
-            if (check_queues(memory)) {
-                PRINT("[W] Post: %d; Worker %d; Service: 0; Post closed, customers waiting\n", post_open, id);
-                continue;
+        case WT_DONE:
+            break;
+    }
+}
+
+/// @brief Client's process
+/// @param memory Program's shared memory
+/// @param id Client's number (1..NZ)
+/// @note Client's start must be already logged, see spawn_clients()
+void process_client(SharedMemory *memory, u_int id) {
+    Client client = {.id = id, .random = random_init(memory->args.seed, ACTOR_CLIENT, id)};
+    DEBUG_ACTOR(ACTOR_CLIENT, id);
+
+    Wait wait = client_start(memory, &client, true);
+    while (wait.type != WT_DONE) {
+        if (wait.type == WT_QUEUE) {
+            // Wait on the node whose workers call the ticket
+            if (memory->topology)
+                pin_to_node(memory->topology, queue_node(memory->topology, wait.arg));
+            wait_ticket(memory, wait.arg, client.ticket);
+        } else
+            process_wait(memory, wait);
+        wait = client_step(memory, &client);
+    }
+}
+
+/// @brief Spawner's process, logs start of a batch of clients and forks them
+/// @param memory Program's shared memory
+/// @param first Number of the first client (1..NZ)
+/// @param count Amount of clients (1..CLIENT_BATCH)
+void spawn_clients(SharedMemory *memory, u_int first, u_int count) {
+    log_clients_started(memory, first, count);
+
+    for (u_int i = 0; i < count; i++) {
+        pid_t pid = fork_actor(memory);
+        if (pid == 0) {
+            process_client(memory, first + i);
+            exit_actor(memory);
+        } else if (pid < 0) {
+            error("Failed to fork a process");
+        }
+    }
+
+    // Wait for the batch to finish
+    while (wait(NULL))
+        if (errno == ECHILD) break;
+}
+
+/// @brief Arrival generator's process, forks every client at its arrival time
+/// @param memory Program's shared memory
+void generate_clients(SharedMemory *memory) {
+    uint64_t start = monotonic_ns();
+
+    for (int i = 0; i < memory->args.NZ; i++) {
+        sleep_until(start + memory->arrivals[i]);
+        log_client(memory, i + 1, 0, CA_STARTED);
+
+        pid_t pid = fork_actor(memory);
+        if (pid == 0) {
+            process_client(memory, i + 1);
+            exit_actor(memory);
+        } else if (pid < 0) {
+            error("Failed to fork a process");
+        }
+    }
+
+    // Wait for all clients to finish
+    while (wait(NULL))
+        if (errno == ECHILD) break;
+}
+
+/// @brief Empties executor's inbox
+/// @param memory Program's shared memory
+/// @param inbox Executor's inbox
+/// @return Index of the first called client, the others follow through inbox_next in order of their calls
+int executor_take_calls(SharedMemory *memory, ExecutorInbox *inbox) {
+    // Stack has the last call on top
+    int stack = atomic_exchange(&inbox->head, -1);
+    int called = -1;
+    while (stack != -1) {
+        int next = memory->inbox_next[stack];
+        memory->inbox_next[stack] = called;
+        called = stack;
+        stack = next;
+    }
+    return called;
+}
+
+/// @brief Parks executor's client until its wait is over
+/// @param memory Program's shared memory
+/// @param timers Executor's timer wheel, tasks are indexes into its clients
+/// @param clients Executor's clients
+/// @param first Index of executor's first client (0..NZ-1)
+/// @param task Index of the client in executor's clients
+/// @param wait Client's wait
+/// @return Whether client has finished
+bool executor_park(SharedMemory *memory, TimerWheel *timers, Client *clients, u_int first, int task, Wait wait) {
+    switch (wait.type) {
+        case WT_SLEEP:
+            TimerWheel_add(timers, monotonic_ns() + (uint64_t)wait.arg * 1000, task);
+            break;
+        case WT_QUEUE: {
+            // Worker that calls the ticket sees TICKET_PARKED and pushes client to inbox,
+            // ticket called before is ready right away
+            TicketSlot *slot = ticket_slot(memory, wait.arg, clients[task].ticket);
+            slot->task = first + task;
+            u_int expected = 0;
+            if (!atomic_compare_exchange_strong(&slot->called, &expected, TICKET_PARKED))
+                TimerWheel_ready(timers, task);
+            break;
+        }
+        case WT_DONE:
+            return true;
+        case WT_POST_CLOSED:
+        case WT_WORK:
+        case WT_BREAK:
+            // Only workers wait for these
+            break;
+    }
+    return false;
+}
+
+/// @brief Executor's process, runs a block of clients as state machines instead of a process per client
+/// @param memory Program's shared memory
+/// @param executor Executor's number (0..executors-1)
+void run_executor(SharedMemory *memory, int executor) {
+    const Arguments *args = &memory->args;
+    ExecutorInbox *inbox = &memory->inboxes[executor];
+    u_int block = executor_block(args);
+    u_int first = executor * block;
+    u_int count = first + block <= (u_int)args->NZ ? block : args->NZ - first;
+    // Executor's clients wait in every queue, so executors are just spread over the nodes
+    if (memory->topology)
+        pin_to_node(memory->topology, executor % memory->topology->nodes);
+
+    // Client's only state is its Client, with a link and a deadline in the timer wheel
+    Client *clients = calloc(count, sizeof(Client));
+    bool *started = calloc(count, sizeof(bool));
+    if (clients == NULL || started == NULL)
+        error("Failed to allocate memory");
+
+    uint64_t start = monotonic_ns();
+    TimerWheel timers;
+    TimerWheel_init(&timers, count, start);
+    for (u_int i = 0; i < count; i++) {
+        u_int id = first + i + 1;
+        clients[i] = (Client){.id = id, .random = random_init(args->seed, ACTOR_CLIENT, id)};
+        // Clients with arrival times start at them, the others start right away like spawn_clients() does
+        if (memory->arrivals)
+            TimerWheel_add(&timers, start + memory->arrivals[id - 1], i);
+        else
+            TimerWheel_ready(&timers, i);
+    }
+    if (!memory->arrivals) {
+        for (u_int i = 0; i < count; i += CLIENT_BATCH)
+            log_clients_started(memory, first + i + 1, i + CLIENT_BATCH <= count ? CLIENT_BATCH : count - i);
+    }
+
+    u_int remaining = count;
+    // Called clients taken from inbox, linked through inbox_next in order of their calls
+    int called = -1;
+    while (remaining > 0) {
+        if (called == -1 && atomic_load_explicit(&inbox->head, memory_order_relaxed) != -1)
+            called = executor_take_calls(memory, inbox);
+
+        // Called clients go before clients whose timers expired
+        int task = -1;
+        uint64_t now = monotonic_ns();
+        if (called != -1) {
+            task = called - first;
+            called = memory->inbox_next[called];
+        } else {
+            // Slots are visited only once the ready list is empty, so the current slot isn't scanned for every step
+            if (timers.ready_head == -1)
+                TimerWheel_expire(&timers, now);
+            task = TimerWheel_pop(&timers);
+        }
+
+        if (task != -1) {
+            Client *client = &clients[task];
+            DEBUG_ACTOR(ACTOR_CLIENT, client->id);
+
+            Wait wait;
+            if (started[task]) {
+                wait = client_step(memory, client);
+            } else {
+                started[task] = true;
+                wait = client_start(memory, client, !memory->arrivals);
             }
+            if (executor_park(memory, &timers, clients, first, task, wait))
+                remaining--;
+            continue;
+        }
 
-            // Post leaving semaphore
-            if (!is_leaving) {
-                PRINT("[W] Post: %d; Worker %d; Service: 0; Post closed, no clients left, sem posted!\n", post_open, id);
-                sem_post(&memory->leaving);
+        // Wait for a call or for the next timer
+        u_int bell = atomic_load(&inbox->bell);
+        atomic_store(&inbox->is_waiting, true);
+        if (atomic_load(&inbox->head) == -1) {
+            struct timespec timeout, *timeout_ptr = NULL;
+            uint64_t next = TimerWheel_next(&timers);
+            if (next != UINT64_MAX) {
+                uint64_t sleep = next > now ? next - now : 0;
+                timeout = (struct timespec){.tv_sec = sleep / 1000000000, .tv_nsec = sleep % 1000000000};
+                timeout_ptr = &timeout;
             }
+            futex_wait(&inbox->bell, bell, timeout_ptr);
+        }
+        atomic_store(&inbox->is_waiting, false);
+    }
 
-            // Unblock any remaining customers
-            for (int i = 0; i < 3; i++) {
-                if (memory->queue[i] > 0) {
-                    sem_post(&memory->queue_sem[i]);
-                }
+    free(clients);
+    free(started);
+    TimerWheel_destroy(&timers);
+}
+
+/// @brief Worker's process
+/// @param memory Program's shared memory
+/// @param id Worker's number (1..NU)
+void process_worker(SharedMemory *memory, u_int id) {
+    Worker worker = {.id = id, .random = random_init(memory->args.seed, ACTOR_WORKER, id)};
+    DEBUG_ACTOR(ACTOR_WORKER, id);
+
+    Wait wait = worker_start(memory, &worker);
+    // Started was logged before pinning, so only the first step runs wherever the worker was forked
+    if (memory->topology)
+        pin_worker(memory->topology, worker.preferred);
+    while (wait.type != WT_DONE) {
+        process_wait(memory, wait);
+        wait = worker_step(memory, &worker);
+    }
+}
+
+/// @brief Post office's part of main process
+/// @param memory Program's shared memory
+void process_office(SharedMemory *memory) {
+    Office office = {.random = random_init(memory->args.seed, ACTOR_OFFICE, 0)};
+    DEBUG_ACTOR(ACTOR_OFFICE, 0);
+
+    Wait wait = office_start(memory, &office);
+    while (wait.type != WT_DONE) {
+        process_wait(memory, wait);
+        wait = office_step(memory, &office);
+    }
+}
+
+/// @brief Makes one step of pool's task
+/// @param pool Pool the task belongs to
+/// @param task Task's number
+/// @return What task waits for before next step
+Wait Pool_step(Pool *pool, int task) {
+    bool started = pool->started[task];
+    pool->started[task] = true;
+
+    const Arguments *args = &pool->memory->args;
+    if (task < args->NZ) {
+        Client *client = &pool->clients[task];
+        DEBUG_ACTOR(ACTOR_CLIENT, client->id);
+        return started ? client_step(pool->memory, client) : client_start(pool->memory, client, false);
+    }
+    if (task < args->NZ + args->NU) {
+        Worker *worker = &pool->workers[task - args->NZ];
+        DEBUG_ACTOR(ACTOR_WORKER, worker->id);
+        return started ? worker_step(pool->memory, worker) : worker_start(pool->memory, worker);
+    }
+
+    Office *office = &pool->office;
+    DEBUG_ACTOR(ACTOR_OFFICE, 0);
+    return started ? office_step(pool->memory, office) : office_start(pool->memory, office);
+}
+
+/// @brief Parks task until its wait is over
+/// @param pool Pool the task belongs to
+/// @param task Task's number
+/// @param wait Task's wait
+/// @note Pool's lock must be held
+void Pool_park(Pool *pool, int task, Wait wait) {
+    switch (wait.type) {
+        case WT_SLEEP:
+        case WT_BREAK: {
+            // Break that started before closing but parks after it ends right away
+            uint64_t sleep = wait.type == WT_BREAK && atomic_load(&pool->memory->is_closed) ? 0 : (uint64_t)wait.arg * 1000;
+            Pool_add_timer(pool, clock_ns(pool->memory) + sleep, task);
+            // Sleeping threads may wait for a later deadline
+            pthread_cond_signal(&pool->cond);
+            break;
+        }
+        case WT_QUEUE: {
+            TicketSlot *slot = ticket_slot(pool->memory, wait.arg, pool->clients[task].ticket);
+            if (atomic_load(&slot->called)) {
+                TaskQueue_push(&pool->ready, task);
+            } else {
+                slot->task = task;
+                slot->is_parked = true;
+            }
+            break;
+        }
+        case WT_POST_CLOSED:
+            if (atomic_load(&pool->memory->is_closed))
+                TaskQueue_push(&pool->ready, task);
+            else
+                TaskQueue_push(&pool->closing, task);
+            break;
+        case WT_WORK: {
+            TaskSem *sem = &pool->work;
+            if (sem->count > 0) {
+                sem->count--;
+                TaskQueue_push(&pool->ready, task);
+            } else {
+                TaskQueue_push(&sem->parked, task);
             }
+            break;
+        }
+        case WT_DONE:
+            if (--pool->remaining == 0)
+                pthread_cond_broadcast(&pool->cond);
+            break;
+    }
+}
+
+/// @brief Pool's thread, steps ready tasks until all of them finish
+/// @param arg Pool
+void* Pool_thread(void *arg) {
+    Pool *pool = arg;
+
+    SharedMemory *memory = pool->memory;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->remaining > 0) {
+        // There's nobody to wait for in virtual time, so just jump to the next deadline
+        if (memory->args.virtual_time && pool->ready.size == 0) {
+            if (pool->timers.count == 0)
+                error("Deadlock in virtual time");
+            memory->virtual_time = pool->timers.timers[0].deadline;
+        }
 
-            PRINT("[W] Post: %d; Worker %d; Service: 0; Post closed, waiting for main process message\n", post_open, id);
-            // Wait for main process to allow worker to finish
-            sem_wait(&memory->post_closed);
+        uint64_t now = clock_ns(memory);
+        while (pool->timers.count > 0 && pool->timers.timers[0].deadline <= now)
+            TaskQueue_push(&pool->ready, TimerHeap_pop(&pool->timers));
 
-            // Finally, finish
-            PRINT("[W] Post: %d; Worker %d; Service: 0; Finished\n", post_open, id);
-            log_worker(memory, id, 0, WA_FINISHED);
-            exit(EXIT_SUCCESS);
+        if (pool->ready.size > 0) {
+            int task = TaskQueue_pop(&pool->ready);
+
+            pthread_mutex_unlock(&pool->lock);
+            Wait wait = Pool_step(pool, task);
+            pthread_mutex_lock(&pool->lock);
+
+            Pool_park(pool, task, wait);
+        } else if (pool->timers.count > 0) {
+            uint64_t deadline = pool->timers.timers[0].deadline;
+            struct timespec ts = {.tv_sec = deadline / 1000000000, .tv_nsec = deadline % 1000000000};
+            pthread_cond_timedwait(&pool->cond, &pool->lock, &ts);
+        } else {
+            pthread_cond_wait(&pool->cond, &pool->lock);
         }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    stats_merge_active(memory);
+    return NULL;
+}
+
+/// @brief Initializes Pool and starts its threads
+/// @param memory Program's shared memory, its pool is set to created Pool
+/// @return Pointer to started Pool
+/// @note Exits with EXIT_FAILURE if error occurred
+Pool* Pool_init(SharedMemory *memory) {
+    Pool *pool = calloc(1, sizeof(Pool));
+    if (pool == NULL)
+        error("Failed to allocate memory");
 
-        // Something seriously went wrong, if we dropped here
-        // It did happen before, but I wasn't able to reproduce it
-        PRINT("[W] Post: %d; Worker %d; Service: 0; We shouldn't be here...\n", post_open, id);
+    const Arguments *args = &memory->args;
+    pool->memory = memory;
+    pool->tasks_count = (size_t)args->NZ + args->NU + 1;
+    pool->remaining = pool->tasks_count;
+
+    pool->threads = calloc(args->threads, sizeof(pthread_t));
+    pool->clients = calloc(args->NZ, sizeof(Client));
+    pool->workers = calloc(args->NU, sizeof(Worker));
+    pool->started = calloc(pool->tasks_count, sizeof(bool));
+    pool->timers.timers = calloc(pool->tasks_count, sizeof(Timer));
+    if (!pool->threads || !pool->clients || !pool->workers || !pool->started || !pool->timers.timers)
+        error("Failed to allocate memory");
+
+    TaskQueue_init(&pool->ready, pool->tasks_count);
+    TaskQueue_init(&pool->work.parked, pool->tasks_count);
+    TaskQueue_init(&pool->closing, pool->tasks_count);
+
+    // Every task makes its first step as soon as possible
+    for (int i = 0; i < args->NZ; i++) {
+        pool->clients[i].id = i + 1;
+        pool->clients[i].random = random_init(args->seed, ACTOR_CLIENT, i + 1);
+    }
+    for (int i = 0; i < args->NU; i++) {
+        pool->workers[i].id = i + 1;
+        pool->workers[i].random = random_init(args->seed, ACTOR_WORKER, i + 1);
     }
+    pool->office.random = random_init(args->seed, ACTOR_OFFICE, 0);
+
+    // Workers and post office go first, so that first clients don't wait for all the others to start
+    for (size_t i = args->NZ; i < pool->tasks_count; i++)
+        TaskQueue_push(&pool->ready, (int)i);
+    // Clients with arrival times start when their time comes
+    for (int i = 0; i < args->NZ; i++) {
+        if (memory->arrivals)
+            Pool_add_timer(pool, clock_ns(memory) + memory->arrivals[i], i);
+        else
+            TaskQueue_push(&pool->ready, i);
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (pthread_mutex_init(&pool->lock, NULL) != 0 || pthread_cond_init(&pool->cond, &attr) != 0)
+        error("Failed to initialize pool");
+    pthread_condattr_destroy(&attr);
+
+    memory->pool = pool;
+
+    for (int i = 0; i < args->threads; i++)
+        if (pthread_create(&pool->threads[i], NULL, Pool_thread, pool) != 0)
+            error("Failed to create a thread");
+
+    return pool;
 }
 
-/// @brief Main function
-/// @param argc Number of arguments
-/// @param argv Arguments' array
-int main(int argc, char** argv) {
-    // Check arguments count
-    if (argc != 6)
-        error("Invalid number of arguments");
+/// @brief Waits for all Pool's tasks to finish and destroys Pool
+/// @param pool Pool to destroy
+void Pool_destroy(Pool *pool) {
+    for (int i = 0; i < pool->memory->args.threads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pool->memory->pool = NULL;
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->work.parked.tasks);
+    free(pool->closing.tasks);
+    free(pool->ready.tasks);
+    free(pool->timers.timers);
+    free(pool->started);
+    free(pool->workers);
+    free(pool->clients);
+    free(pool->threads);
+    free(pool);
+}
 
+/// @brief Parses and checks simulation's parameters
+/// @param args Arguments to set parameters in
+/// @param values NZ, NU, TZ, TU and F, in this order
+/// @note Exits with EXIT_FAILURE if error occurred
+void parse_params(Arguments *args, char** values) {
     // Parse all arguments
-    int NZ = parse_int_arg(argv[1]);
-    int NU = parse_int_arg(argv[2]);
-    int TZ = parse_int_arg(argv[3]);
-    int TU = parse_int_arg(argv[4]);
-    int F  = parse_int_arg(argv[5]);
+    args->NZ = parse_int_arg(values[0]);
+    args->NU = parse_int_arg(values[1]);
+    args->TZ = parse_int_arg(values[2]);
+    args->TU = parse_int_arg(values[3]);
+    args->F  = parse_int_arg(values[4]);
 
     // Check arguments' ranges
-    if (!(  NZ > 0
-        &&  NU > 0
-        &&  check_range(TZ, 0, 10000)
-        &&  check_range(TU, 0, 100)
-        &&  check_range(F, 0, 10000)
+    if (!(  args->NZ > 0
+        &&  args->NU > 0
+        &&  check_range(args->TZ, 0, 10000)
+        &&  check_range(args->TU, 0, 100)
+        &&  check_range(args->F, 0, 10000)
     ))
         error("Invalid input arguments");
+}
+
+/// @brief Parses distribution of service time, `[SERVICE=]uniform:MAX`, `fixed:MEAN`, `exp:MEAN`
+/// or `lognormal:MEAN:SIGMA`, without service it applies to all services
+/// @param args Program's arguments to set service time in
+/// @param spec Service time to parse
+/// @note Exits with EXIT_FAILURE if error occurred
+void parse_service_time(Arguments *args, const char *spec) {
+    char *end;
+    int service = 0;
+    if (strchr(spec, '=')) {
+        service = (int)strtol(spec, &end, 10);
+        if (*end != '=' || !check_range(service, 1, MAX_SERVICES))
+            error("Invalid service of service time");
+        spec = end + 1;
+    }
+
+    static const struct {
+        const char *name;
+        enum ServiceDistribution type;
+    } distributions[] = {
+        {"uniform:", SD_UNIFORM},
+        {"fixed:", SD_FIXED},
+        {"exp:", SD_EXPONENTIAL},
+        {"lognormal:", SD_LOGNORMAL}
+    };
+
+    ServiceTime time = {0};
+    size_t i = 0;
+    for (; i < sizeof(distributions) / sizeof(distributions[0]); i++)
+        if (strncmp(spec, distributions[i].name, strlen(distributions[i].name)) == 0)
+            break;
+    if (i == sizeof(distributions) / sizeof(distributions[0]))
+        error("Invalid distribution of service time");
+
+    time.type = distributions[i].type;
+    time.time = strtod(spec + strlen(distributions[i].name), &end);
+    if (time.type == SD_LOGNORMAL && *end == ':')
+        time.sigma = strtod(end + 1, &end);
+    if (*end != '\0' || !(time.time >= 0) || !(time.sigma >= 0) || (time.type == SD_LOGNORMAL && !(time.time > 0)))
+        error("Invalid service time");
+
+    for (int s = 1; s <= MAX_SERVICES; s++)
+        if (service == 0 || service == s)
+            args->service_times[s - 1] = time;
+}
+
+/// @brief Parses program's options and arguments
+/// @param argc Number of arguments
+/// @param argv Arguments' array
+/// @return Parsed arguments
+/// @note Exits with EXIT_FAILURE if error occurred
+Arguments parse_args(int argc, char** argv) {
+    Arguments args = {.services = 3};
+    // Service takes up to 10 ms by default
+    for (int i = 0; i < MAX_SERVICES; i++)
+        args.service_times[i] = (ServiceTime){SD_UNIFORM, 10, 0};
+
+    static const struct option options[] = {
+        {"threads", optional_argument, NULL, 't'},
+        {"log", required_argument, NULL, 'l'},
+        {"seed", required_argument, NULL, 's'},
+        {"virtual-time", no_argument, NULL, 'v'},
+        {"batch", required_argument, NULL, 'b'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"latency", no_argument, NULL, 'L'},
+        {"services", required_argument, NULL, 'S'},
+        {"schedule", required_argument, NULL, 'p'},
+        {"arrivals", required_argument, NULL, 'a'},
+        {"stats", no_argument, NULL, 'P'},
+        {"check", no_argument, NULL, 'C'},
+        {"executors", optional_argument, NULL, 'e'},
+        {"huge-pages", no_argument, NULL, 'H'},
+        {"prefault", no_argument, NULL, 'f'},
+        {"pin", no_argument, NULL, 'n'},
+        {"service-time", required_argument, NULL, 'T'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (option) {
+            case 't':
+                // Pool is sized to the core count by default
+                args.threads = optarg ? parse_int_arg(optarg) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+                if (args.threads <= 0)
+                    error("Invalid number of threads");
+                break;
+            case 'l':
+                if (strcmp(optarg, "stdio") == 0)
+                    args.log_mode = LOG_STDIO;
+                else if (strcmp(optarg, "ring") == 0)
+                    args.log_mode = LOG_RING;
+                else if (strcmp(optarg, "binary") == 0)
+                    args.log_mode = LOG_BINARY;
+                else if (strcmp(optarg, "mmap") == 0)
+                    args.log_mode = LOG_MMAP;
+                else
+                    error("Invalid log mode");
+                break;
+            case 'v':
+                args.virtual_time = true;
+                break;
+            case 'b':
+                args.batch = optarg;
+                break;
+            case 'L':
+                args.latency = true;
+                break;
+            case 'S':
+                args.services = parse_int_arg(optarg);
+                if (!check_range(args.services, 1, MAX_SERVICES))
+                    error("Invalid number of services");
+                break;
+            case 'p':
+                if (strcmp(optarg, "random") == 0)
+                    args.schedule = SP_RANDOM;
+                else if (strcmp(optarg, "affinity") == 0)
+                    args.schedule = SP_AFFINITY;
+                else
+                    error("Invalid schedule policy");
+                break;
+            case 'a':
+                if (strcmp(optarg, "uniform") == 0) {
+                    args.arrivals = AM_UNIFORM;
+                } else if (strncmp(optarg, "poisson:", 8) == 0) {
+                    char *end;
+                    args.arrivals = AM_POISSON;
+                    args.arrival_rate = strtod(optarg + 8, &end);
+                    if (*end != '\0' || !(args.arrival_rate > 0))
+                        error("Invalid arrival rate");
+                } else if (strncmp(optarg, "trace:", 6) == 0 && optarg[6] != '\0') {
+                    args.arrivals = AM_TRACE;
+                    args.arrival_trace = optarg + 6;
+                } else {
+                    error("Invalid arrival model");
+                }
+                break;
+            case 'T':
+                parse_service_time(&args, optarg);
+                break;
+            case 'P':
+                args.stats = true;
+                break;
+            case 'C':
+                args.check = true;
+                break;
+            case 'e':
+                // One executor per core by default
+                args.executors = optarg ? parse_int_arg(optarg) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+                if (args.executors <= 0)
+                    error("Invalid number of executors");
+                break;
+            case 'H':
+                args.huge_pages = true;
+                break;
+            case 'f':
+                args.prefault = true;
+                break;
+            case 'n':
+                args.pin = true;
+                break;
+            case 'j':
+                args.jobs = parse_int_arg(optarg);
+                if (args.jobs <= 0)
+                    error("Invalid number of jobs");
+                break;
+            case 's': {
+                char *end;
+                args.seed = strtoull(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0')
+                    error("Invalid seed");
+                args.has_seed = true;
+                break;
+            }
+            default:
+                error("Invalid option");
+        }
+    }
+
+    // Check arguments count, batch file has them instead
+    if (argc - optind != (args.batch ? 0 : 5))
+        error("Invalid number of arguments");
+
+    if (!args.batch)
+        parse_params(&args, argv + optind);
+    if (args.jobs == 0)
+        args.jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    args.output = args.log_mode == LOG_BINARY ? "proj2.trace" : "proj2.out";
+
+    // Discrete-event simulation runs all tasks on one thread
+    if (args.virtual_time)
+        args.threads = 1;
+
+    // Runs are reproducible only with user's seed
+    // time xor getpid() is random enough otherwise
+    if (!args.has_seed)
+        args.seed = monotonic_ns() ^ ((uint64_t)getpid() << 32);
 
-    PRINT("[M] NZ: %d, NU: %d, TZ: %d, TU: %d, F: %d\n", NZ, NU, TZ, TU, F);
+    return args;
+}
+
+/// @brief Runs one simulation
+/// @param args Simulation's arguments
+/// @return Simulation's outcome
+/// @note Exits with EXIT_FAILURE if error occurred
+Result simulate(const Arguments *args) {
+    int NZ = args->NZ, NU = args->NU;
+    uint64_t start = monotonic_ns();
 
     // Initialize shared memory
-    SharedMemory *shared = SharedMemory_init();
+    SharedMemory *shared = SharedMemory_init(args);
 
-    // Fork clients
-    for (int i = 0; i < NZ; i++) {
-        pid_t pid = fork();
-        if (pid == 0) {
-            process_client(shared, i + 1, TZ);
-        } else if (pid < 0) {
-            SharedMemory_destroy(shared);
-            error("Failed to fork a process");
+    PRINT("[M] NZ: %d, NU: %d, TZ: %d, TU: %d, F: %d, threads: %d, virtual time: %d\n", NZ, NU, args->TZ, args->TU, args->F, args->threads, args->virtual_time);
+
+    if (args->threads > 0) {
+        // Run clients, workers and post office as tasks in this process
+        Pool *pool = Pool_init(shared);
+
+        PRINT("[M] Waiting for pool's tasks\n");
+        Pool_destroy(pool);
+    } else {
+        // Fork workers first, so that first clients get served while the others are still forked
+        for (int i = 0; i < NU; i++) {
+            pid_t pid = fork_actor(shared);
+            if (pid == 0) {
+                process_worker(shared, i + 1);
+                exit_actor(shared);
+            } else if (pid < 0) {
+                SharedMemory_destroy(shared);
+                error("Failed to fork a process");
+            }
+        }
+
+        // Clients are run by executors
+        for (int i = 0; shared->inboxes && (u_int)i * executor_block(args) < (u_int)NZ; i++) {
+            pid_t pid = fork_actor(shared);
+            if (pid == 0) {
+                run_executor(shared, i);
+                exit_actor(shared);
+            } else if (pid < 0) {
+                SharedMemory_destroy(shared);
+                error("Failed to fork a process");
+            }
+        }
+
+        // Or they're forked in batches, every batch is forked by its own spawner in parallel,
+        // or by one generator at their arrival times
+        for (int first = 1; !shared->inboxes && first <= NZ; first += shared->arrivals ? NZ : CLIENT_BATCH) {
+            pid_t pid = fork_actor(shared);
+            if (pid == 0) {
+                if (shared->arrivals)
+                    generate_clients(shared);
+                else
+                    spawn_clients(shared, first, first + CLIENT_BATCH - 1 <= NZ ? CLIENT_BATCH : NZ - first + 1);
+                exit_actor(shared);
+            } else if (pid < 0) {
+                SharedMemory_destroy(shared);
+                error("Failed to fork a process");
+            }
         }
+
+        process_office(shared);
+
+        PRINT("[M] Waiting for children processes\n");
+        // Wait for all children to finish
+        while (wait(NULL))
+            if (errno == ECHILD) break;
     }
 
-    // Fork workers
-    for (int i = 0; i < NU; i++) {
-        pid_t pid = fork();
-        if (pid == 0) {
-            process_worker(shared, i + 1, TU);
-        } else if (pid < 0) {
-            SharedMemory_destroy(shared);
-            error("Failed to fork a process");
+    // Everybody else merged their interval of events already
+    stats_merge_active(shared);
+    // Every entering client took a ticket and every served one was called, the others were turned away
+    size_t entered = 0, called = 0;
+    for (int i = 0; i < args->services; i++) {
+        entered += atomic_load(&shared->queues[i].tail);
+        called += atomic_load(&shared->queues[i].head);
+    }
+    Result result = {
+        .served = called,
+        .turned_away = NZ - entered,
+        .events = logged_events(shared),
+        .active_ms = (atomic_load(&shared->stats->last_event_at) - atomic_load(&shared->stats->first_event_at)) / 1e6
+    };
+    uint64_t closed_at = atomic_load(&shared->stats->closed_at);
+    long children_rss_kb = atomic_load(&shared->stats->rss_kb);
+    if (shared->checker)
+        check_end(shared);
+    if (args->latency)
+        print_latencies(shared);
+#ifdef SEM_STATS
+    print_sem_stats(shared);
+#endif
+    PRINT("[M] Done\n");
+
+    // Clean up, debug messages are printed now
+    SharedMemory_destroy(shared);
+    uint64_t end = monotonic_ns();
+    result.wall_ms = (end - start) / 1e6;
+    result.close_ms = (end - closed_at) / 1e6;
+
+    // Every process waited for its children, so they include all descendants
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    result.max_rss_kb = self.ru_maxrss > children.ru_maxrss ? self.ru_maxrss : children.ru_maxrss;
+    result.total_rss_kb = self.ru_maxrss + children_rss_kb;
+
+    return result;
+}
+
+/// @brief Reads configurations from batch file
+/// @param args Program's arguments, every configuration inherits them
+/// @param count Amount of read configurations
+/// @return Array of configurations, free() it after use
+/// @note Exits with EXIT_FAILURE if error occurred
+Arguments* read_batch(const Arguments *args, size_t *count) {
+    FILE *file = fopen(args->batch, "r");
+    if (file == NULL)
+        error("Failed to open batch file");
+
+    Arguments *configs = NULL;
+    size_t capacity = 0;
+    *count = 0;
+
+    // Every line is NZ NU TZ TU F, empty lines and lines starting with # are skipped
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        char *values[6];
+        int values_count = 0;
+        for (char *value = strtok(line, " \t\r\n"); value && values_count < 6; value = strtok(NULL, " \t\r\n"))
+            values[values_count++] = value;
+
+        if (values_count == 0 || values[0][0] == '#')
+            continue;
+        if (values_count != 5)
+            error("Invalid line in batch file");
+
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            configs = realloc(configs, capacity * sizeof(Arguments));
+            if (configs == NULL)
+                error("Failed to allocate memory");
         }
+
+        Arguments *config = &configs[(*count)++];
+        *config = *args;
+        config->batch = NULL;
+        parse_params(config, values);
     }
 
-    PRINT("[M] Randomly sleeping\n");
+    fclose(file);
+    return configs;
+}
 
-    // Do that random sleep
-    random_sleep(F / 2, F);
+/// @brief Runs all configurations from batch file, some of them at once, and prints their outcomes as CSV
+/// @param args Program's arguments
+/// @note Exits with EXIT_FAILURE if error occurred
+void run_batch(const Arguments *args) {
+    size_t count;
+    Arguments *configs = read_batch(args, &count);
 
-    PRINT("[M] Done sleeping, closing post\n");
+    // Children write their outcomes here
+    Result *results = mmap(NULL, (count ? count : 1) * sizeof(Result), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED)
+        error("Failed to allocate memory");
+
+    // Fits any configuration's number
+    char (*outputs)[sizeof "proj2-" + 20 + sizeof ".trace"] = calloc(count ? count : 1, sizeof(*outputs));
+    if (outputs == NULL)
+        error("Failed to allocate memory");
 
-    // Close the office
-    shared->post_open = 0;
+    size_t running = 0;
+    bool failed = false;
+    for (size_t i = 0; i < count || running > 0;) {
+        // Start as many configurations as allowed, then wait for any of them to finish
+        if (i < count && running < (size_t)args->jobs) {
+            snprintf(outputs[i], sizeof(outputs[i]), "proj2-%zu.%s", i + 1, args->log_mode == LOG_BINARY ? "trace" : "out");
+            configs[i].output = outputs[i];
+            // Same configuration with the same seed gives the same run wherever it is in the file
+            if (!configs[i].has_seed)
+                configs[i].seed ^= random_init(configs[i].seed, ACTOR_OFFICE, i + 1);
+
+            pid_t pid = fork();
+            if (pid == 0) {
+                results[i] = simulate(&configs[i]);
+                exit(EXIT_SUCCESS);
+            } else if (pid < 0) {
+                error("Failed to fork a process");
+            }
+            running++;
+            i++;
+            continue;
+        }
 
-    PRINT("[M] Post is closed, waiting for workers to finish\n");
-    // Wait for workers to finish
-    for (int i = 0; i < NU; i++) {
-        sem_wait(&shared->leaving);
+        int status;
+        if (wait(&status) == -1)
+            error("Failed to wait for a process");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            failed = true;
+        running--;
     }
-    // Print closing message
-    log_office(shared);
 
-    PRINT("[M] Sending message to workers\n");
-    // Tell workers that they can finish
-    for (int i = 0; i < NU; i++) {
-        sem_post(&shared->post_closed);
+    printf("config,NZ,NU,TZ,TU,F,served,turned_away,wall_ms,active_ms,events,events_per_s,close_ms,max_rss_kb,total_rss_kb\n");
+    for (size_t i = 0; i < count; i++) {
+        const Arguments *config = &configs[i];
+        const Result *result = &results[i];
+        printf("%zu,%d,%d,%d,%d,%d,%zu,%zu,%.3f,%.3f,%zu,%.0f,%.3f,%ld,%ld\n", i + 1, config->NZ, config->NU, config->TZ, config->TU, config->F,
+               result->served, result->turned_away, result->wall_ms, result->active_ms, result->events,
+               result->active_ms > 0 ? result->events / (result->active_ms / 1000) : 0.0, result->close_ms, result->max_rss_kb, result->total_rss_kb);
     }
 
-    PRINT("[M] Waiting for children processes\n");
-    // Wait for all children to finish
-    while (wait(NULL))
-        if (errno == ECHILD) break;
+    munmap(results, (count ? count : 1) * sizeof(Result));
+    free(outputs);
+    free(configs);
 
-    // Clean up
-    SharedMemory_destroy(shared);
+    if (failed)
+        error("Some of configurations failed");
+}
 
-    PRINT("[M] Done\n");
+/// @brief Main function
+/// @param argc Number of arguments
+/// @param argv Arguments' array
+int main(int argc, char** argv) {
+    Arguments args = parse_args(argc, argv);
+
+    if (args.batch)
+        run_batch(&args);
+    else
+        simulate(&args);
 
     return 0;
 }
@@ -0,0 +1,219 @@
+///
+/// @file proj2.h
+/// @brief Events of the post office shared by proj2 and its tools
+/// @date 30.04.2023
+/// @author Konstantin Romanets (xroman18), xroman18(at)stud.fit.vutbr.cz
+///
+/// @copyright VUT FIT 2023
+///
+
+#ifndef PROJ2_H
+#define PROJ2_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/// Max amount of service types, each of them has a bit in non-empty queues mask
+#define MAX_SERVICES 64
+
+/// Size of cache line, counters written by different actors don't share them
+#define CACHE_LINE_SIZE 64
+
+/// Prefix of shared memory name with live statistics, followed by simulation's pid
+#define STATS_NAME "/proj2-"
+
+/// Represents worker's actions.
+enum WorkerAction {
+    // Started
+    WA_STARTED,
+    // Serving a service
+    WA_SERVING_START,
+    // Service finished
+    WA_SERVING_END,
+    // Taking a break
+    WA_BREAK_START,
+    // Break finished
+    WA_BREAK_END,
+    // Going home
+    WA_FINISHED
+};
+
+/// Represents client's actions.
+enum ClientAction {
+    // Started
+    CA_STARTED,
+    // Entering office for service
+    CA_ENTERING_OFFICE,
+    // Called by office worker
+    CA_CALLED_BY_WORKER,
+    // Going home
+    CA_FINISHED
+};
+
+/// Represents who did the logged action.
+enum Actor {
+    // Client, action is enum ClientAction
+    ACTOR_CLIENT,
+    // Worker, action is enum WorkerAction
+    ACTOR_WORKER,
+    // Post office, the only action is closing
+    ACTOR_OFFICE
+};
+
+/// One logged event, binary trace keeps it as TraceEntry
+typedef struct trace_record {
+    // Line number of the event in text output
+    uint64_t seq;
+    // Monotonic time of the event in nanoseconds
+    uint64_t time;
+    // Client's or worker's number, 0 for post office
+    uint32_t id;
+    // enum Actor
+    uint8_t actor;
+    // enum ClientAction or enum WorkerAction
+    uint8_t action;
+    // Type of service (1..services), 0 if no service
+    uint16_t service;
+} TraceRecord;
+
+/// One event in binary trace \n
+/// Binary trace is an array of these in native byte order, entry i is line i + 1 of text output
+typedef struct trace_entry {
+    // Time of the event since start of the simulation in microseconds, wraps after about 71 minutes
+    uint32_t time_us;
+    // Client's or worker's number, 0 for post office
+    uint32_t id;
+    // enum Actor
+    uint8_t actor;
+    // enum ClientAction or enum WorkerAction
+    uint8_t action;
+    // Type of service (1..services), 0 if no service
+    uint16_t service;
+} TraceEntry;
+
+_Static_assert(sizeof(TraceEntry) == 12, "TraceEntry must not have padding");
+
+/// @brief Packs event into binary trace's entry
+/// @param record Event to pack
+/// @param start Time of the start of the simulation in nanoseconds
+/// @return Entry of the event
+static inline TraceEntry trace_entry(const TraceRecord *record, uint64_t start) {
+    return (TraceEntry){
+        .time_us = (uint32_t)((record->time - start) / 1000),
+        .id = record->id,
+        .actor = record->actor,
+        .action = record->action,
+        .service = record->service
+    };
+}
+
+/// @brief Unpacks entry of binary trace
+/// @param entry Entry to unpack
+/// @param index Entry's index in trace, it gives the line number
+/// @return Event with time since start of the simulation in nanoseconds
+static inline TraceRecord trace_record(const TraceEntry *entry, uint64_t index) {
+    return (TraceRecord){
+        .seq = index + 1,
+        .time = (uint64_t)entry->time_us * 1000,
+        .id = entry->id,
+        .actor = entry->actor,
+        .action = entry->action,
+        .service = entry->service
+    };
+}
+
+/// Clients waiting in one queue, on its own cache line like the queue itself
+typedef struct stats_queue {
+    _Alignas(CACHE_LINE_SIZE) atomic_int count;
+} StatsQueue;
+
+/// Live statistics of a running simulation \n
+/// Counters are updated with relaxed atomics only with --stats, readers never take any of simulation's locks \n
+/// Every counter written on the hot path has its own cache line
+typedef struct stats {
+    // Process id of the simulation
+    uint32_t pid;
+    // Amount of service types
+    uint32_t services;
+    // Monotonic time of the start in nanoseconds
+    uint64_t started;
+    // Logged events
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t events;
+    // Monotonic time of the first logged event and of the last client's event in nanoseconds, 0 before them
+    _Atomic uint64_t first_event_at;
+    _Atomic uint64_t last_event_at;
+    // Clients called by a worker
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t served;
+    // Clients that came to a closed office
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t turned_away;
+    // Sum of peak resident set sizes of finished actor processes in kilobytes, also without --stats
+    _Atomic uint64_t rss_kb;
+    // Workers serving a client
+    _Alignas(CACHE_LINE_SIZE) atomic_int serving;
+    // Workers on break
+    _Alignas(CACHE_LINE_SIZE) atomic_int on_break;
+    // Workers waiting for work
+    _Alignas(CACHE_LINE_SIZE) atomic_int idle;
+    // Monotonic time of closing in nanoseconds, also without --stats
+    _Atomic uint64_t closed_at;
+    // Post office is closed
+    atomic_bool closed;
+    // Simulation has finished, the statistics won't change anymore
+    atomic_bool finished;
+    // Clients waiting in every queue
+    StatsQueue queues[MAX_SERVICES];
+} Stats;
+
+/// @brief Returns current monotonic time, Stats keep their times in it
+/// @return Time in nanoseconds
+static inline uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/// @brief Formats event as a line of text output, including the new line
+/// @param buffer Buffer to format line into
+/// @param size Size of buffer
+/// @param record Event to format
+/// @return Length of formatted line, as snprintf() does
+static inline int format_record(char *buffer, size_t size, const TraceRecord *record) {
+    unsigned long long seq = record->seq;
+    unsigned id = record->id, service = record->service;
+
+    if (record->actor == ACTOR_CLIENT) {
+        switch (record->action) {
+            case CA_STARTED:
+                return snprintf(buffer, size, "%llu: Z %u: started\n", seq, id);
+            case CA_ENTERING_OFFICE:
+                return snprintf(buffer, size, "%llu: Z %u: entering office for a service %u\n", seq, id, service);
+            case CA_CALLED_BY_WORKER:
+                return snprintf(buffer, size, "%llu: Z %u: called by office worker\n", seq, id);
+            case CA_FINISHED:
+                return snprintf(buffer, size, "%llu: Z %u: going home\n", seq, id);
+        }
+    } else if (record->actor == ACTOR_WORKER) {
+        switch (record->action) {
+            case WA_STARTED:
+                return snprintf(buffer, size, "%llu: U %u: started\n", seq, id);
+            case WA_SERVING_START:
+                return snprintf(buffer, size, "%llu: U %u: serving a service of type %u\n", seq, id, service);
+            case WA_SERVING_END:
+                return snprintf(buffer, size, "%llu: U %u: service finished\n", seq, id);
+            case WA_BREAK_START:
+                return snprintf(buffer, size, "%llu: U %u: taking break\n", seq, id);
+            case WA_BREAK_END:
+                return snprintf(buffer, size, "%llu: U %u: break finished\n", seq, id);
+            case WA_FINISHED:
+                return snprintf(buffer, size, "%llu: U %u: going home\n", seq, id);
+        }
+    } else if (record->actor == ACTOR_OFFICE) {
+        return snprintf(buffer, size, "%llu: closing\n", seq);
+    }
+
+    return -1;
+}
+
+#endif // PROJ2_H
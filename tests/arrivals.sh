@@ -0,0 +1,49 @@
+#!/bin/bash
+
+# Microbenchmark of contended arrivals: all clients enter the office within the same millisecond,
+# prints how many clients entered per second, measured on the binary trace
+
+if [ "$1" == "-h" ]; then
+    echo "Usage: ./arrivals.sh [PROGRAM...]"
+    echo "  PROGRAM: proj2 binaries to compare (../proj2 by default)"
+    echo "  NZ, THREADS and RUNS environment variables change the amount of clients (20000),"
+    echo "  thread counts (1 2 4 nproc) and runs per measurement (5, median is printed)"
+    exit 0
+fi
+
+programs=("$@")
+[ ${#programs[@]} -eq 0 ] && programs=("../proj2")
+
+NZ=${NZ:-20000}
+THREADS=${THREADS:-"1 2 4 $(nproc)"}
+RUNS=${RUNS:-5}
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+# Clients entering per second, from the first entering client to the last one
+# Entry is time in microseconds, id and actor | action << 8 | service << 16, entry i is line i + 1,
+# client entering is actor 0, action 1
+entering_rate() {
+    od -An -v -t u4 -w12 proj2.trace | awk '
+        $3 % 65536 == 256 {
+            if (count == 0 || $1 < first) first = $1
+            if ($1 > last) last = $1
+            count++
+        }
+        END { if (last > first) printf "%.0f\n", count / ((last - first) / 1e6); else print 0 }'
+}
+
+printf "%-24s %8s %16s\n" "program" "threads" "entering/s"
+for program in "${programs[@]}"; do
+    program=$(realpath "$program")
+    for threads in $THREADS; do
+        rates=()
+        for ((run = 0; run < RUNS; run++)); do
+            (cd "$workdir" && "$program" --threads=$threads --log=binary --seed=$run $NZ $((NZ / 8)) 1 1 100) || exit 1
+            rates+=($(cd "$workdir" && entering_rate))
+        done
+        median=$(printf "%s\n" "${rates[@]}" | sort -n | sed -n "$((RUNS / 2 + 1))p")
+        printf "%-24s %8d %16d\n" "$(basename "$program")" $threads $median
+    done
+done
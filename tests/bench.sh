@@ -0,0 +1,52 @@
+#!/bin/bash
+
+# Benchmark of the hot paths: fixed-seed runs with TZ=TU=0 and zero service time over a grid of NZ and NU
+# in every execution mode, so that only synchronization and logging is measured,
+# prints one CSV line per run with events per second over the interval from the first event to the last client's event, wall time,
+# time from closing to finish, peak RSS of the largest process and sum of all processes' peak RSS; served and turned_away show whether clients of a mode came before closing
+
+if [ "$1" == "-h" ]; then
+    echo "Usage: ./bench.sh [PROGRAM]"
+    echo "  PROGRAM: proj2 binary to measure (../proj2 by default)"
+    echo "  NZ, NU, F, SEED and MODES environment variables change the amounts of clients (1000 10000 100000),"
+    echo "  amounts of workers (1 16 256), closing time (100), seed (1) and execution modes"
+    echo "  (process executors pool virtual: forked processes, --executors, --threads and --virtual-time),"
+    echo "  OPTIONS are passed to every run"
+    exit 0
+fi
+
+program=$(realpath "${1:-../proj2}")
+
+NZ=${NZ:-"1000 10000 100000"}
+NU=${NU:-"1 16 256"}
+F=${F:-100}
+SEED=${SEED:-1}
+MODES=${MODES:-"process executors pool virtual"}
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+for nz in $NZ; do
+    for nu in $NU; do
+        echo "$nz $nu 0 0 $F"
+    done
+done > "$workdir/grid"
+
+header=true
+for mode in $MODES; do
+    case $mode in
+        process) mode_options="" ;;
+        executors) mode_options="--executors" ;;
+        pool) mode_options="--threads=$(nproc)" ;;
+        virtual) mode_options="--virtual-time" ;;
+        *) echo "Unknown mode $mode" >&2; exit 1 ;;
+    esac
+
+    # One run at a time, so that runs don't compete for cores
+    csv=$(cd "$workdir" && "$program" --batch=grid --jobs=1 --seed=$SEED --service-time=fixed:0 $mode_options $OPTIONS) || exit 1
+    if $header; then
+        echo "mode,$(echo "$csv" | head -n 1)"
+        header=false
+    fi
+    echo "$csv" | tail -n +2 | sed "s/^/$mode,/"
+done